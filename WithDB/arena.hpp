@@ -0,0 +1,193 @@
+#ifndef __ARENA_HPP__
+#define __ARENA_HPP__
+
+// page frame arena for cache levels: huge page backed, numa placed and never pre-touched
+
+#include "type_config.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace db {
+	namespace ns::arena {
+#ifndef _WIN32
+		// mbind policy values from linux/mempolicy.h, avoid linking libnuma
+		constexpr int MPOL_BIND_POLICY = 2;
+		constexpr int MPOL_INTERLEAVE_POLICY = 3;
+		constexpr std::size_t MAX_NODE_MASK_BIT = 64;
+#endif
+
+		inline std::size_t round_up(std::size_t size, std::size_t align) {
+			return align ? (size + align - 1) / align * align : size;
+		}
+	}
+
+	struct arena {
+		char *memory;
+		std::size_t length; // mapped length, may be rounded to huge page size
+		std::size_t request; // requested length
+		bool huge;
+
+	public:
+		arena() : memory(nullptr), length(0), request(0), huge(false) {
+		}
+
+		// node: ARENA_INTERLEAVE_NODE for interleaving across all nodes, otherwise bind to the node
+		explicit arena(std::size_t size, int node = ARENA_INTERLEAVE_NODE, bool huge_page = KEEPER_ARENA_HUGE_PAGE) : arena() {
+			allocate(size, node, huge_page);
+		}
+
+		arena(const arena &other) = delete;
+
+		arena(arena &&other) : memory(other.memory), length(other.length), request(other.request), huge(other.huge) {
+			other.memory = nullptr;
+			other.length = 0;
+			other.request = 0;
+		}
+
+		arena &operator=(const arena &other) = delete;
+
+		arena &operator=(arena &&other) {
+			if (this != &other) {
+				release();
+				memory = other.memory;
+				length = other.length;
+				request = other.request;
+				huge = other.huge;
+				other.memory = nullptr;
+				other.length = 0;
+				other.request = 0;
+			}
+			return *this;
+		}
+
+		~arena() {
+			release();
+		}
+
+		inline char *begin() {
+			return memory;
+		}
+
+		inline char *end() {
+			return memory + request;
+		}
+
+		inline std::size_t size() const {
+			return request;
+		}
+
+		inline bool is_huge() const {
+			return huge;
+		}
+
+#ifdef _WIN32
+		void allocate(std::size_t size, int node, bool huge_page) {
+			release();
+			request = size;
+			if (!size) {
+				return;
+			}
+			auto numa_node = node == ARENA_INTERLEAVE_NODE ? NUMA_NO_PREFERRED_NODE : static_cast<DWORD>(node);
+			// large page requires SeLockMemoryPrivilege, fall back to normal page silently
+			auto large = huge_page ? GetLargePageMinimum() : 0;
+			if (large) {
+				length = ns::arena::round_up(size, large);
+				memory = static_cast<char *>(VirtualAllocExNuma(GetCurrentProcess(), nullptr, length,
+					MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, numa_node));
+				huge = memory != nullptr;
+			}
+			if (!memory) {
+				length = size;
+				// committed memory is demand-zero, pages are not touched until first access
+				memory = static_cast<char *>(VirtualAllocExNuma(GetCurrentProcess(), nullptr, length,
+					MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, numa_node));
+			}
+			if (!memory) {
+				length = 0;
+				request = 0;
+				throw std::bad_alloc();
+			}
+		}
+
+		void release() {
+			if (memory) {
+				VirtualFree(memory, 0, MEM_RELEASE);
+			}
+			memory = nullptr;
+			length = 0;
+			huge = false;
+		}
+#else
+		void allocate(std::size_t size, int node, bool huge_page) {
+			release();
+			request = size;
+			if (!size) {
+				return;
+			}
+			void *ptr = MAP_FAILED;
+			if (huge_page) {
+				length = ns::arena::round_up(size, ARENA_HUGE_PAGE_SIZE);
+				ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				huge = ptr != MAP_FAILED;
+			}
+			if (ptr == MAP_FAILED) {
+				length = huge_page ? ns::arena::round_up(size, ARENA_HUGE_PAGE_SIZE) : size;
+				ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+				if (ptr == MAP_FAILED) {
+					length = 0;
+					request = 0;
+					throw std::bad_alloc();
+				}
+#ifdef MADV_HUGEPAGE
+				// no reserved huge pages, ask transparent huge page instead
+				if (huge_page) {
+					madvise(ptr, length, MADV_HUGEPAGE);
+				}
+#endif
+			}
+			memory = static_cast<char *>(ptr);
+			bind(node);
+		}
+
+		// place before first touch, failure only loses locality so ignore it
+		void bind(int node) {
+#ifdef SYS_mbind
+			unsigned long mask = 0;
+			int policy = ns::arena::MPOL_INTERLEAVE_POLICY;
+			if (node == ARENA_INTERLEAVE_NODE) {
+				mask = ~0ul;
+			} else if (node >= 0 && static_cast<std::size_t>(node) < ns::arena::MAX_NODE_MASK_BIT) {
+				mask = 1ul << node;
+				policy = ns::arena::MPOL_BIND_POLICY;
+			} else {
+				return;
+			}
+			syscall(SYS_mbind, memory, length, policy, &mask, ns::arena::MAX_NODE_MASK_BIT, 0);
+#endif
+		}
+
+		void release() {
+			if (memory) {
+				munmap(memory, length);
+			}
+			memory = nullptr;
+			length = 0;
+			huge = false;
+		}
+#endif
+	};
+}
+
+#endif // __ARENA_HPP__
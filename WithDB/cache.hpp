@@ -1,14 +1,21 @@
 #ifndef __CACHE_HPP__
 #define __CACHE_HPP__
 
+#include "arena.hpp"
 #include "page.hpp"
 #include "type_config.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -71,6 +78,12 @@ namespace db {
 			logs.insert(std::make_pair(addr, cache_log(current_timestamp())));
 		}
 
+		// an address erased from the cache must not come back as a victim
+		void erase(Address addr) {
+			std::unique_lock<std::mutex> lock(access_mutex);
+			logs.erase(addr);
+		}
+
 		void access(Address addr) {
 			std::unique_lock<std::mutex> lock(access_mutex);
 			auto iter = logs.find(addr);
@@ -120,6 +133,71 @@ namespace db {
 		}
 	};
 
+	// plain counters copied out of cache_stats
+	struct cache_counter {
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t evictions = 0;
+		std::uint64_t write_backs = 0;
+		std::uint64_t pin_waits = 0; // pin failed because other holder pinned the page
+		std::uint64_t pin_spins = 0; // busy loop iterations waiting for pin
+		std::uint64_t prefetches = 0; // pages loaded by prefetch, not counted as misses
+		std::uint64_t prefetch_hits = 0; // prefetched pages held before eviction
+		std::uint64_t prefetch_wasted = 0; // prefetched pages evicted without a hold
+	};
+
+	// page cache counters, relaxed atomic because workers and pages update them concurrently
+	struct cache_stats {
+		std::atomic<std::uint64_t> hits;
+		std::atomic<std::uint64_t> misses;
+		std::atomic<std::uint64_t> evictions;
+		std::atomic<std::uint64_t> write_backs;
+		std::atomic<std::uint64_t> pin_waits;
+		std::atomic<std::uint64_t> pin_spins;
+		std::atomic<std::uint64_t> prefetches;
+		std::atomic<std::uint64_t> prefetch_hits;
+		std::atomic<std::uint64_t> prefetch_wasted;
+
+	public:
+		cache_stats() : hits(0), misses(0), evictions(0), write_backs(0), pin_waits(0), pin_spins(0), prefetches(0), prefetch_hits(0), prefetch_wasted(0) {
+		}
+
+		cache_stats(const cache_stats &other) : cache_stats() {
+			*this += other.snapshot();
+		}
+
+		cache_stats &operator+=(const cache_counter &counter) {
+			hits.fetch_add(counter.hits, std::memory_order_relaxed);
+			misses.fetch_add(counter.misses, std::memory_order_relaxed);
+			evictions.fetch_add(counter.evictions, std::memory_order_relaxed);
+			write_backs.fetch_add(counter.write_backs, std::memory_order_relaxed);
+			pin_waits.fetch_add(counter.pin_waits, std::memory_order_relaxed);
+			pin_spins.fetch_add(counter.pin_spins, std::memory_order_relaxed);
+			prefetches.fetch_add(counter.prefetches, std::memory_order_relaxed);
+			prefetch_hits.fetch_add(counter.prefetch_hits, std::memory_order_relaxed);
+			prefetch_wasted.fetch_add(counter.prefetch_wasted, std::memory_order_relaxed);
+			return *this;
+		}
+
+		static inline void add(std::atomic<std::uint64_t> &counter, std::uint64_t value = 1) {
+			counter.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		cache_counter snapshot() const {
+			cache_counter ret;
+			ret.hits = hits.load(std::memory_order_relaxed);
+			ret.misses = misses.load(std::memory_order_relaxed);
+			ret.evictions = evictions.load(std::memory_order_relaxed);
+			ret.write_backs = write_backs.load(std::memory_order_relaxed);
+			ret.pin_waits = pin_waits.load(std::memory_order_relaxed);
+			ret.pin_spins = pin_spins.load(std::memory_order_relaxed);
+			ret.prefetches = prefetches.load(std::memory_order_relaxed);
+			ret.prefetch_hits = prefetch_hits.load(std::memory_order_relaxed);
+			ret.prefetch_wasted = prefetch_wasted.load(std::memory_order_relaxed);
+			return ret;
+		}
+	};
+
 	// interface handler for cache insert-erase operation
 	// handler can change its own status for the operation
 	template<typename Address, typename Type>
@@ -128,6 +206,14 @@ namespace db {
 		virtual bool cache_insert(Address addr, Type &value) = 0;
 		// handle cache erase and put mapping value in &value for cleaning/write_back ...
 		virtual bool cache_erase(Address addr, Type &value) = 0;
+		// dirty frame of page cache, lsn is the last logged change of the page
+		virtual bool cache_write_back(Address addr, Type &value, std::uint64_t) {
+			return cache_erase(addr, value);
+		}
+		// log is durable up to the returned lsn, write back of a frame logged before it forces nothing
+		virtual std::uint64_t cache_durable_lsn() {
+			return std::numeric_limits<std::uint64_t>::max();
+		}
 	};
 
 
@@ -161,10 +247,15 @@ namespace db {
 		}
 
 		bool erase(Address addr) {
-			auto value = value_map[addr];
-			auto flag = value_map.erase(addr);
+			replace.erase(addr);
+			auto iter = value_map.find(addr);
+			if (iter == value_map.end()) {
+				return false;
+			}
+			auto value = iter->second;
+			value_map.erase(iter);
 			handler.cache_erase(addr, value);
-			return flag;
+			return true;
 		}
 
 		Type get(Address addr) {
@@ -186,6 +277,10 @@ namespace db {
 			return iter->second;
 		}
 
+		bool contains(Address addr) {
+			return value_map.find(addr) != value_map.end();
+		}
+
 		bool is_pinned(Address addr) {
 			return replace.is_pinned(addr);
 		}
@@ -199,92 +294,427 @@ namespace db {
 		}
 	};
 
+	// page cache over a fixed array of frame descriptors
+	// pin count and generation live in frame, so page handles need no allocation and no reference counting
+	// latch only guards address mapping, disk io of a miss runs outside latch so hits never wait behind misses
 	template<typename Address>
 	struct cache<Address, page> {
-		using control_pair = std::pair<typename std::vector<char>::iterator, typename std::vector<char>::iterator>;
-		using control_ptr = std::shared_ptr<control_pair>;
-		std::vector<char> memory;
-		std::vector<control_ptr> ptrs;
+		struct cache_frame : frame {
+			Address addr;
+			timestamp accessAt;
+			bool used;
+			bool loading; // locked frame is writing back old page or reading new page
+			bool prefetched; // loaded ahead of use and not held since
+
+			cache_frame() : addr(0), accessAt(0), used(false), loading(false), prefetched(false) {
+			}
+		};
+
+		arena memory;
+		std::vector<cache_frame> frames;
 		std::unordered_map<Address, std::size_t> position_map;
-		cache_replace<Address> replace;
+		std::unordered_map<Address, std::uint64_t> writing; // addresses whose write back is in flight, with their redo start
+		std::mutex latch;
+		std::condition_variable latch_cond;
 		cache_handler<Address, page> &handler;
+		cache_stats stats;
 	public:
-		cache(std::size_t size, cache_handler<Address, page> &handler) : memory(size * PAGE_SIZE),
-			ptrs(size), replace(size), handler(handler) {
+		cache(std::size_t size, cache_handler<Address, page> &handler, int node = ARENA_INTERLEAVE_NODE) : memory(size * PAGE_SIZE, node),
+			frames(size), handler(handler) {
 		}
 
-		cache(const cache &other): cache(other.ptrs.size(), other.handler){
+		cache(const cache &other): cache(other.frames.size(), other.handler){
 		}
 
 		cache(cache &&other) :
 			memory(std::move(other.memory)),
-			ptrs(std::move(other.ptrs)),
+			frames(std::move(other.frames)),
 			position_map(std::move(other.position_map)),
-			replace(std::move(other.replace)), handler(other.handler) {
+			handler(other.handler), stats(other.stats) {
 
 		}
 
-		bool insert(Address addr, page &value) {
-			bool flag = handler.cache_insert(addr, value);
-			// TODO: hacking way to get page index in cache
-			if (flag) {
-				position_map.insert(std::make_pair(addr, (value.begin() - memory.begin()) / PAGE_SIZE));
-				replace.success(addr);
+		inline page frame_page(std::size_t index) {
+			auto first = memory.begin() + index * PAGE_SIZE;
+			auto &f = frames[index];
+			return page(first, first + PAGE_SIZE, &f, f.generation.load(std::memory_order_acquire));
+		}
+
+		// raw memory of a locked frame, invisible to handles while io is running
+		inline page raw_page(std::size_t index) {
+			auto first = memory.begin() + index * PAGE_SIZE;
+			return page(first, first + PAGE_SIZE);
+		}
+
+		// free frame first, otherwise MRU unpinned frame, returned frame is locked against pin
+		// a frame whose write back needs no log force wins over MRU, so filling pages forces log once per round
+		// prefetched frames not held yet go last, MRU would otherwise drop them before their first use
+		// fallible victim returns frames.size() instead of throwing when every frame is pinned
+		// latch must be held
+		std::size_t victim(bool fallible = false) {
+			auto durable = handler.cache_durable_lsn();
+			auto rank = [durable](cache_frame &f) {
+				auto cheap = !f.dirty.load(std::memory_order_relaxed) || f.page_lsn.load(std::memory_order_relaxed) <= durable;
+				return (f.prefetched ? 0 : 2) + (cheap ? 1 : 0);
+			};
+			while (true) {
+				auto ret = frames.size();
+				for (std::size_t i = 0; i != frames.size(); ++i) {
+					auto &f = frames[i];
+					if (f.pin_cnt.load(std::memory_order_relaxed) != 0) {
+						continue;
+					}
+					// evicting a page while its checkpoint copy is written could reorder the two writes
+					if (f.used && !writing.empty() && writing.find(f.addr) != writing.end()) {
+						continue;
+					}
+					if (!f.used) {
+						ret = i;
+						break;
+					}
+					if (ret == frames.size()) {
+						ret = i;
+						continue;
+					}
+					auto a = rank(f);
+					auto b = rank(frames[ret]);
+					if (a != b ? a > b : f.accessAt > frames[ret].accessAt) {
+						ret = i;
+					}
+				}
+				if (ret == frames.size()) {
+					if (fallible) {
+						return ret;
+					}
+					throw std::runtime_error("[cache::victim] all addresses are pinned");
+				}
+				if (frames[ret].lock()) {
+					return ret;
+				}
 			}
-			return flag;
 		}
 
+		// erase fails when the page is pinned or loading
 		bool erase(Address addr) {
-			auto index = position_map[addr];
-			position_map.erase(addr);
-			page tmp(std::move(ptrs[index]));
-			auto flag = handler.cache_erase(addr, tmp);
-			tmp.deactivate();
-			return flag;
+			std::unique_lock<std::mutex> lock(latch);
+			auto iter = position_map.find(addr);
+			if (iter == position_map.end()) {
+				return false;
+			}
+			auto index = iter->second;
+			auto &f = frames[index];
+			if (f.loading || writing.find(addr) != writing.end() || !f.lock()) {
+				return false;
+			}
+			position_map.erase(iter);
+			f.invalidate();
+			f.used = false;
+			f.loading = true;
+			if (f.prefetched) {
+				f.prefetched = false;
+				cache_stats::add(stats.prefetch_wasted);
+			}
+			auto dirty = f.dirty.exchange(false);
+			auto lsn = f.page_lsn.exchange(0);
+			writing.emplace(addr, f.rec_lsn.exchange(0));
+			lock.unlock();
+
+			auto tmp = raw_page(index);
+			std::exception_ptr error;
+			try {
+				if (dirty && handler.cache_write_back(addr, tmp, lsn)) {
+					cache_stats::add(stats.write_backs);
+				}
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			lock.lock();
+			writing.erase(addr);
+			f.loading = false;
+			f.unlock();
+			latch_cond.notify_all();
+			lock.unlock();
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			return true;
 		}
 
-		page get(Address addr) {
-			auto iter = position_map.find(addr);
-			std::size_t index = 0;
-			if (iter != position_map.end()) {
-				index = iter->second;
-				replace.access(addr);
-			} else {
-				auto result = replace(addr);
-				if (result != addr) {
-					index = position_map[result];
-					erase(result);
-				} else {
-					for (index = 0; index < ptrs.size(); ++index) {
-						if (!ptrs[index]) {
-							break;
-						}
+		// prefetching load leaves a resident page as it is and is not counted as a miss
+		// a miss with full set finds no victim among pinned frames, sets *full and returns an empty page instead of throwing
+		page get(Address addr, bool prefetching = false, bool *full = nullptr) {
+			std::unique_lock<std::mutex> lock(latch);
+			while (true) {
+				auto iter = position_map.find(addr);
+				if (iter != position_map.end()) {
+					auto &f = frames[iter->second];
+					if (f.loading) {
+						latch_cond.wait(lock);
+						continue;
+					}
+					if (prefetching) {
+						return frame_page(iter->second);
 					}
+					used_prefetched(f);
+					f.accessAt = current_timestamp();
+					cache_stats::add(stats.hits);
+					return frame_page(iter->second);
 				}
-				ptrs[index].reset();
-				auto alloc_begin = memory.begin() + index * PAGE_SIZE;
-				auto alloc_end = alloc_begin + PAGE_SIZE;
-				auto tmp = std::make_shared<control_pair>(std::make_pair(alloc_begin, alloc_end));
-				page tmp_page(tmp);
-				bool flag = insert(addr, tmp_page);
-				if (!flag) {
-					throw std::runtime_error("[cache::get] cannot find address mapping value");
+				if (writing.find(addr) != writing.end()) {
+					latch_cond.wait(lock); // read after write back finishes
+					continue;
+				}
+				break;
+			}
+
+			auto index = victim(full != nullptr);
+			if (index == frames.size()) {
+				*full = true;
+				return page();
+			}
+			cache_stats::add(prefetching ? stats.prefetches : stats.misses);
+			auto &f = frames[index];
+			auto old = f.addr;
+			auto evicting = f.used;
+			if (evicting && f.prefetched) {
+				cache_stats::add(stats.prefetch_wasted);
+			}
+			f.prefetched = prefetching;
+			// clean page is dropped without io, its copy on drive is current
+			auto dirty = f.dirty.exchange(false) && evicting;
+			auto lsn = f.page_lsn.exchange(0);
+			auto rec = f.rec_lsn.exchange(0);
+			if (evicting) {
+				position_map.erase(old);
+				writing.emplace(old, dirty ? rec : 0);
+				cache_stats::add(stats.evictions);
+			}
+			f.invalidate();
+			f.addr = addr;
+			f.accessAt = current_timestamp();
+			f.used = true;
+			f.loading = true;
+			position_map.insert(std::make_pair(addr, index));
+			lock.unlock();
+
+			auto tmp = raw_page(index);
+			bool flag = false;
+			std::exception_ptr error;
+			try {
+				if (dirty && handler.cache_write_back(old, tmp, lsn)) {
+					cache_stats::add(stats.write_backs);
+				}
+				flag = handler.cache_insert(addr, tmp);
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			lock.lock();
+			if (evicting) {
+				writing.erase(old);
+			}
+			f.loading = false;
+			if (!flag) {
+				position_map.erase(addr);
+				f.used = false;
+			}
+			auto ret = frame_page(index);
+			f.unlock();
+			latch_cond.notify_all();
+			lock.unlock();
+
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			if (!flag) {
+				throw std::runtime_error("[cache::get] cannot find address mapping value");
+			}
+			return ret;
+		}
+
+		bool contains(Address addr) {
+			std::unique_lock<std::mutex> lock(latch);
+			return position_map.find(addr) != position_map.end();
+		}
+
+		// write back a dirty resident page without evicting it, the page stays readable while its copy is written
+		// pinned page is skipped and left dirty for the next checkpoint
+		bool flush(std::size_t index) {
+			std::unique_lock<std::mutex> lock(latch);
+			auto &f = frames[index];
+			if (!f.used || f.loading || !f.dirty.load() || writing.find(f.addr) != writing.end() || !f.lock()) {
+				return false;
+			}
+			auto addr = f.addr;
+			auto first = memory.begin() + index * PAGE_SIZE;
+			std::vector<char> copy(first, first + PAGE_SIZE);
+			f.dirty = false;
+			auto lsn = f.page_lsn.exchange(0);
+			auto rec = f.rec_lsn.exchange(0);
+			f.unlock();
+			writing.emplace(addr, rec);
+			lock.unlock();
+
+			page tmp(copy.data(), copy.data() + PAGE_SIZE);
+			std::exception_ptr error;
+			try {
+				if (handler.cache_write_back(addr, tmp, lsn)) {
+					cache_stats::add(stats.write_backs);
+				}
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			lock.lock();
+			writing.erase(addr);
+			if (error) {
+				// still resident, next write back retries
+				auto iter = position_map.find(addr);
+				if (iter != position_map.end() && iter->second == index) {
+					f.mark_logging(rec);
+					f.mark_logged(lsn);
+				}
+			}
+			latch_cond.notify_all();
+			lock.unlock();
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			return true;
+		}
+
+		// block until a write back of addr from this cache reaches the handler, used before another cache reads addr
+		void wait_written(Address addr) {
+			std::unique_lock<std::mutex> lock(latch);
+			while (writing.find(addr) != writing.end()) {
+				latch_cond.wait(lock);
+			}
+		}
+
+		// block until no write back from this cache is in flight
+		void wait_writes() {
+			std::unique_lock<std::mutex> lock(latch);
+			while (!writing.empty()) {
+				latch_cond.wait(lock);
+			}
+		}
+
+		// oldest redo start among dirty and in-flight pages, UINT64_MAX when everything is on drive
+		std::uint64_t min_rec_lsn() {
+			std::unique_lock<std::mutex> lock(latch);
+			auto ret = std::numeric_limits<std::uint64_t>::max();
+			for (auto &f : frames) {
+				auto rec = f.rec_lsn.load();
+				if (f.used && rec) {
+					ret = std::min(ret, rec);
+				}
+			}
+			for (auto &pair : writing) {
+				if (pair.second) {
+					ret = std::min(ret, pair.second);
+				}
+			}
+			return ret;
+		}
+
+		// hit only, never waits for io and never loads
+		bool try_get(Address addr, page &value) {
+			std::unique_lock<std::mutex> lock(latch);
+			auto iter = position_map.find(addr);
+			if (iter == position_map.end() || frames[iter->second].loading) {
+				return false;
+			}
+			used_prefetched(frames[iter->second]);
+			frames[iter->second].accessAt = current_timestamp();
+			cache_stats::add(stats.hits);
+			value = frame_page(iter->second);
+			return true;
+		}
+
+		// first hold of a prefetched page, latch must be held
+		inline void used_prefetched(cache_frame &f) {
+			if (f.prefetched) {
+				f.prefetched = false;
+				cache_stats::add(stats.prefetch_hits);
+			}
+		}
+
+		bool is_full() {
+			std::unique_lock<std::mutex> lock(latch);
+			return position_map.size() >= frames.size();
+		}
+
+		// one past the last resident or in-flight page in [first, last), first when there is none
+		Address resident_end(Address first, Address last) {
+			std::unique_lock<std::mutex> lock(latch);
+			auto ret = first;
+			for (auto &pair : position_map) {
+				if (pair.first >= first && pair.first < last) {
+					ret = std::max(ret, pair.first + PAGE_SIZE);
 				}
-				ptrs[index] = std::move(tmp);
 			}
-			return page(ptrs[index]);
+			for (auto &pair : writing) {
+				if (pair.first >= first && pair.first < last) {
+					ret = std::max(ret, pair.first + PAGE_SIZE);
+				}
+			}
+			return ret;
+		}
+
+		// set access time directly, used to restore recency after warm-up
+		void touch(Address addr, timestamp accessAt) {
+			std::unique_lock<std::mutex> lock(latch);
+			auto iter = position_map.find(addr);
+			if (iter != position_map.end()) {
+				frames[iter->second].accessAt = accessAt;
+			}
+		}
+
+		// addresses ordered from the most recent access to the least recent one
+		std::vector<Address> recency() {
+			std::vector<std::pair<timestamp, Address>> order;
+			std::unique_lock<std::mutex> lock(latch);
+			for (auto &pair : position_map) {
+				order.emplace_back(frames[pair.second].accessAt, pair.first);
+			}
+			lock.unlock();
+			std::sort(order.begin(), order.end(), [](const std::pair<timestamp, Address> &a, const std::pair<timestamp, Address> &b) {
+				return a.first > b.first;
+			});
+			std::vector<Address> ret;
+			for (auto &pair : order) {
+				ret.push_back(pair.second);
+			}
+			return ret;
 		}
 
 		bool is_pinned(Address addr) {
-			return replace.is_pinned(addr);
+			std::unique_lock<std::mutex> lock(latch);
+			auto iter = position_map.find(addr);
+			return iter != position_map.end() && frames[iter->second].is_pinned();
 		}
 
 		bool pin(Address addr) {
-			return replace.pin(addr);
+			std::unique_lock<std::mutex> lock(latch);
+			auto iter = position_map.find(addr);
+			if (iter == position_map.end()) {
+				throw std::runtime_error("[cache::pin] cannot find address in cache");
+			}
+			auto &f = frames[iter->second];
+			auto flag = f.pin(f.generation.load(std::memory_order_acquire));
+			if (!flag) {
+				cache_stats::add(stats.pin_waits);
+			}
+			return flag;
 		}
 
 		void unpin(Address addr) {
-			replace.unpin(addr);
+			std::unique_lock<std::mutex> lock(latch);
+			auto iter = position_map.find(addr);
+			if (iter != position_map.end() && frames[iter->second].is_pinned()) {
+				frames[iter->second].unpin();
+			}
 		}
 	};
 }
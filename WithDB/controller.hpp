@@ -1,10 +1,16 @@
 #pragma once
 
 #include "keeper.hpp"
+#include "pax.hpp"
+#include "scan.hpp"
+#include "transaction.hpp"
 #include "tuple.hpp"
 
 #include <iostream>
+#include <map>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 // simple controller to wrap, almost crap
 namespace db {
@@ -25,6 +31,11 @@ namespace db {
 				}
 			);
 			k.start();
+			// transactions cut by a crash are undone before anyone reads
+			for (auto &loser : k.losers) {
+				transaction(k, loser.first, loser.second).abort();
+			}
+			k.losers.clear();
 			std::cerr << std::hex;
 		}
 
@@ -38,6 +49,31 @@ namespace db {
 		}
 
 		address put(const std::string &row, address start = 0) {
+			return insert(build(row), start);
+		}
+
+		transaction begin() {
+			return transaction(k);
+		}
+
+		// rows of a table go to its own segment, put and get_all take the returned start address
+		// tables share the schema of controller, format of the first page is kept by pages appended after it
+		address create_table(std::size_t level = segment_cache_level(DATA_SEG), page_format_enum format = ROW_PAGE) {
+			auto start = k.create_segment(DATA_SEG, level);
+			if (format == PAX_PAGE) {
+				pax_page p(std::move(k.hold(start)));
+				p.latch();
+				p.init(*table);
+			}
+			return start;
+		}
+
+		// row stays invisible to snapshots and is undone on abort until txn commits
+		address put(transaction &txn, const std::string &row, address start = 0) {
+			return insert(build(row), start, &txn);
+		}
+
+		std::shared_ptr<tuple> build(const std::string &row) {
 			std::stringstream ss(row);
 			std::string item;
 			int i = 0;
@@ -73,26 +109,70 @@ namespace db {
 
 			auto out = builder.get();
 			builder.reset();
+			return out;
+		}
+
+		address insert(const std::shared_ptr<tuple> &out, address start = 0, transaction *txn = nullptr) {
 			address ret = 0;
+			bool done = false;
+			auto format = ROW_PAGE; // clean page takes the format of the page before it
+			auto reserve = PAX_VARCHAR_RESERVE; // and pax minipages are sized by varchar values seen there
 
-			for (db::address addr = start; addr < SEGMENT_SIZE; addr += db::PAGE_SIZE) {
-				db::tuple_page p(std::move(k.hold(addr)));
-				try {
-					p.load();
-				} catch (std::out_of_range e) {
+			for (db::address addr = start; !done && addr < segment_end(start); addr += db::PAGE_SIZE) {
+				auto held = k.hold(addr);
+				auto current = page_format(held);
+				format = current ? current : format;
+				if (format == PAX_PAGE) {
+					db::pax_page p(std::move(held));
+					done = insert_into(p, *out, txn, ret, reserve);
+					reserve = p.heap_reserve();
+				} else {
+					db::tuple_page p(std::move(held));
+					done = insert_into(p, *out, txn, ret);
+				}
+			}
+			return ret;
+		}
+
+		// false when the tuple does not fit the page
+		template<typename Page>
+		bool insert_into(Page &p, const tuple &out, transaction *txn, address &ret, std::size_t reserve = PAX_VARCHAR_RESERVE) {
+			p.latch();
+			try {
+				p.load();
+			} catch (const std::out_of_range &) {
+				if constexpr (std::is_same_v<Page, pax_page>) {
+					p.init(*table, reserve);
+				} else {
 					p.init();
 				}
-				try {
-					auto result = p.allocate(static_cast<page_address>(out->size()));
+			}
+			try {
+				if (txn) {
+					p.txn = txn->id;
+				}
+				if constexpr (std::is_same_v<Page, pax_page>) {
+					auto result = p.allocate(out);
+					if (txn) {
+						txn->will_insert(p, result);
+					}
+					p.copy_from(out, result);
+					ret = p.addr + result;
+					return true;
+				} else {
+					auto result = p.allocate(static_cast<page_address>(out.size()));
+					if (txn) {
+						txn->will_insert(p, result);
+					}
 					auto pa = p.get(result);
-					p.copy_from(out->begin(), pa.first, pa.second);
+					p.copy_from(out.begin(), pa.first, pa.second);
 					ret = p.addr + result;
-					break;
-				} catch (std::out_of_range e) {
-					// std::cerr << e.what() << endl;
+					return true;
 				}
+			} catch (const std::out_of_range &) {
+				// std::cerr << e.what() << endl;
 			}
-			return ret;
+			return false;
 		}
 
 		void put_from_file(const std::string &filename, bool all_log = true) {
@@ -107,23 +187,77 @@ namespace db {
 				}
 				++counter;
 			}
+			k.sync();
 			std::cerr << "put success, total = " << counter << std::endl;
 		}
 
-		std::string get(address addr) {
-			db::tuple_page p(std::move(k.hold((addr / PAGE_SIZE) * PAGE_SIZE)));
+		// snapshots started before the erase still see the row
+		bool erase(address addr) {
+			return erase(addr, nullptr);
+		}
+
+		bool erase(transaction &txn, address addr) {
+			return erase(addr, &txn);
+		}
+
+		// row changed by a running transaction can not be erased by another writer
+		bool erase(address addr, transaction *txn) {
+			return visit_page(k.hold((addr / PAGE_SIZE) * PAGE_SIZE), [&](auto &p) {
+				p.latch();
+				try {
+					p.load();
+				} catch (const std::out_of_range &) {
+					return false;
+				}
+				auto index = static_cast<page_address>(addr % PAGE_SIZE);
+				if (!p.is_live(index)) {
+					return false;
+				}
+				if (k.versions.is_locked(p.addr, index, txn ? txn->id : 0)) {
+					throw std::runtime_error("[controller::erase] row is changed by a running transaction");
+				}
+				if (txn) {
+					p.txn = txn->id;
+					txn->will_erase(p, index);
+				}
+				p.free(index);
+				return true;
+			});
+		}
+
+		std::string get(address addr, access_enum mode = DEFAULT_ACCESS) {
+			return visit_page(k.hold((addr / PAGE_SIZE) * PAGE_SIZE, mode), [&](auto &p) {
+				try {
+					p.load();
+				} catch (const std::out_of_range &) {
+					return std::string();
+				}
+				return format(p, static_cast<page_address>(addr % PAGE_SIZE));
+			});
+		}
+
+		// row of a loaded page as tab separated text
+		std::string format(db::tuple_page &p, page_address index) {
 			std::stringstream ss;
-			try {
-				p.load();
-			} catch (std::out_of_range e) {
-				return ss.str();
-			}
-			auto pa = p.get(static_cast<page_address>(addr % PAGE_SIZE));
+			auto pa = p.get(index);
 			if (pa.second == 0) {
 				return ss.str();
 			}
 			db::tuple tmp(pa.second - pa.first);
 			p.copy_to(tmp.begin(), pa.first, pa.second);
+			return format(tmp);
+		}
+
+		std::string format(db::pax_page &p, page_address index) {
+			if (!p.is_live(index)) {
+				return std::string();
+			}
+			auto tmp = p.gather(index);
+			return format(tmp);
+		}
+
+		std::string format(db::tuple &tmp) {
+			std::stringstream ss;
 			for (int i = 0; i < table->size(); ++i) {
 				attribute_type_enum e = (*table)[i].get_type();
 				switch (e) {
@@ -146,32 +280,59 @@ namespace db {
 					break;
 				case db::BLOB_T:
 				default:
-					throw std::runtime_error("[controller::get] unknown type");
+					throw std::runtime_error("[controller::format] unknown type");
 				}
 				ss << '\t';
 			}
 			return ss.str();
 		}
 
+		// rows as of the start of the scan, a writer of a page waits on its pin while the page is copied
 		int get_all(int br = 0, address start = 0) {
 			int counter = 0;
-			for (auto addr = start; addr >= 0; addr += PAGE_SIZE) {
-				tuple_page p(std::move(k.hold(addr)));
-				try {
-					p.load();
-				} catch (std::out_of_range e) {
-					break;
+			db::snapshot s(k.versions);
+			auto last = k.segment_extent(start); // pages past it have never been written
+			std::vector<address> batch;
+			for (auto addr = start; addr < last;) {
+				batch.clear();
+				for (std::size_t i = 0; i != KEEPER_SCAN_BATCH && addr < last; ++i, addr += PAGE_SIZE) {
+					batch.push_back(addr);
+				}
+				// full scan should not evict working set of point lookup
+				auto pages = k.hold_many(batch, SCAN_ACCESS);
+				// copy the whole batch before formatting, no page stays pinned behind output
+				std::vector<std::map<page_address, db::tuple>> images;
+				for (auto &held : pages) {
+					try {
+						images.push_back(visit_page(std::move(held), [&s](auto &p) {
+							return p.read_snapshot(s.ts);
+						}));
+					} catch (const std::out_of_range &) {
+						// clean page holds no row, a table may go on after it
+					}
 				}
-				
-				for (auto &entry : p.piece_table) {
-					std::cout << get(p.addr + entry.index) << std::endl;
-					++counter;
-					if (br && counter % br == 0) {
-						std::getchar();
+
+				for (auto &rows : images) {
+					for (auto &pair : rows) {
+						std::cout << format(pair.second) << std::endl;
+						++counter;
+						if (br && counter % br == 0) {
+							std::getchar();
+						}
 					}
 				}
 			}
 			return counter;
 		}
+
+		// batches of typed values of columns, for operators looping over arrays instead of formatted rows
+		batch_scan scan(std::vector<std::size_t> columns, address start = 0) {
+			return batch_scan(k, table, std::move(columns), start);
+		}
+
+		// rows never cross into the next segment, it belongs to another table
+		inline static address segment_end(address addr) {
+			return (addr / SEGMENT_SIZE + 1) * SEGMENT_SIZE;
+		}
 	};
 }
\ No newline at end of file
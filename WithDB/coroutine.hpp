@@ -0,0 +1,160 @@
+#ifndef __COROUTINE_HPP__
+#define __COROUTINE_HPP__
+
+// executor resuming coroutines whose keeper request completed, and a fire-and-forget coroutine type
+
+#include "task_queue.hpp"
+#include "type_config.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace db {
+	// a handful of threads drive any number of suspended coroutines
+	struct executor {
+		mpmc_ring<void *> ready; // coroutine frame addresses
+		std::mutex overflow_mutex;
+		std::deque<void *> overflow; // posted by executor threads while ready is full
+		std::atomic<bool> has_overflow;
+		event_count ready_event;
+		std::vector<std::thread> threads;
+		std::atomic<bool> start_flag;
+
+	public:
+		explicit executor(std::size_t thread_count = EXECUTOR_THREAD_COUNT, std::size_t capacity = EXECUTOR_QUEUE_SIZE) :
+			ready(capacity), has_overflow(false), start_flag(true) {
+			for (std::size_t i = 0; i != std::max<std::size_t>(thread_count, 1); ++i) {
+				threads.emplace_back([this]() { this->thread_loop(); });
+			}
+		}
+
+		executor(const executor &other) = delete;
+		executor &operator=(const executor &other) = delete;
+
+		~executor() {
+			stop();
+		}
+
+		// a full queue only yields until executor threads catch up
+		// an executor thread would wait for itself, so its posts spill into overflow instead
+		void post(std::coroutine_handle<> handle) {
+			if (!ready.try_push(handle.address())) {
+				if (current() == this) {
+					std::unique_lock<std::mutex> lock(overflow_mutex);
+					overflow.push_back(handle.address());
+					has_overflow.store(true, std::memory_order_release);
+				} else {
+					ready.push(handle.address());
+				}
+			}
+			ready_event.notify_one();
+		}
+
+		// awaiting schedule() moves the coroutine onto an executor thread
+		auto schedule() {
+			struct awaiter {
+				executor *owner;
+
+				bool await_ready() const noexcept {
+					return false;
+				}
+
+				void await_suspend(std::coroutine_handle<> handle) {
+					owner->post(handle);
+				}
+
+				void await_resume() const noexcept {
+				}
+			};
+			return awaiter{ this };
+		}
+
+		// queued coroutines are still resumed before threads exit
+		void stop() {
+			start_flag = false;
+			ready_event.notify_all();
+			for (auto &thread : threads) {
+				thread.join();
+			}
+			threads.clear();
+		}
+
+	private:
+		// executor of the calling thread, null outside executor threads
+		inline static executor *&current() {
+			thread_local executor *owner = nullptr;
+			return owner;
+		}
+
+		bool take(void *&address) {
+			if (ready.try_pop(address)) {
+				return true;
+			}
+			if (!has_overflow.load(std::memory_order_acquire)) {
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(overflow_mutex);
+			if (overflow.empty()) {
+				return false;
+			}
+			address = overflow.front();
+			overflow.pop_front();
+			has_overflow.store(!overflow.empty(), std::memory_order_release);
+			return true;
+		}
+
+		void thread_loop() {
+			current() = this;
+			void *address;
+			while (true) {
+				if (take(address)) {
+					std::coroutine_handle<>::from_address(address).resume();
+					continue;
+				}
+				auto key = ready_event.prepare();
+				if (take(address)) {
+					ready_event.cancel();
+					std::coroutine_handle<>::from_address(address).resume();
+				} else if (!start_flag.load()) {
+					ready_event.cancel();
+					return;
+				} else {
+					ready_event.wait(key);
+				}
+			}
+		}
+	};
+
+	// eagerly started coroutine nobody waits for, frame is freed when it finishes
+	struct detached_task {
+		struct promise_type {
+			detached_task get_return_object() noexcept {
+				return detached_task();
+			}
+
+			std::suspend_never initial_suspend() noexcept {
+				return {};
+			}
+
+			std::suspend_never final_suspend() noexcept {
+				return {};
+			}
+
+			void return_void() noexcept {
+			}
+
+			void unhandled_exception() noexcept {
+				std::terminate();
+			}
+		};
+	};
+}
+
+#endif // __COROUTINE_HPP__
@@ -13,6 +13,13 @@
 #include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace db {
 	struct fpage_wrapper {
 		constexpr static std::ios_base::openmode DEFAULT_MODE = std::ios_base::in | std::ios_base::out;
@@ -58,6 +65,32 @@ namespace db {
 			fs.close();
 		}
 
+		// flush() only hands bytes to the os, this makes them durable before the log that covers them is dropped
+		void sync_file() {
+			fs.flush();
+			if (!fs) {
+				throw std::runtime_error("[fpage_wrapper::sync_file] cannot flush database file");
+			}
+#ifdef _WIN32
+			auto file = CreateFileA(path.string().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				throw std::runtime_error("[fpage_wrapper::sync_file] cannot open database file");
+			}
+			auto ok = FlushFileBuffers(file);
+			CloseHandle(file);
+#else
+			auto file = ::open(path.c_str(), O_WRONLY);
+			if (file < 0) {
+				throw std::runtime_error("[fpage_wrapper::sync_file] cannot open database file");
+			}
+			auto ok = !fsync(file); // fdatasync would skip the size change of an expand
+			::close(file);
+#endif
+			if (!ok) {
+				throw std::runtime_error("[fpage_wrapper::sync_file] cannot sync database file");
+			}
+		}
+
 		drive_address size() {
 			return std::filesystem::file_size(path);
 		}
@@ -284,9 +317,9 @@ namespace db {
 		std::mt19937 random_engine;
 
 		drive() :
-			entry_memory(PAGE_SIZE), entry(entry_memory.begin(), entry_memory.end()),
-			master_memory(PAGE_SIZE + free_master_page::HEADER_SIZE), master(master_memory.begin(), master_memory.begin() + PAGE_SIZE), tmp_master(master_memory.begin() + PAGE_SIZE, master_memory.end()),
-			slave_memory(free_slave_page::HEADER_SIZE), slave(slave_memory.begin(), slave_memory.end()) {
+			entry_memory(PAGE_SIZE), entry(entry_memory.data(), entry_memory.data() + entry_memory.size()),
+			master_memory(PAGE_SIZE + free_master_page::HEADER_SIZE), master(master_memory.data(), master_memory.data() + PAGE_SIZE), tmp_master(master_memory.data() + PAGE_SIZE, master_memory.data() + master_memory.size()),
+			slave_memory(free_slave_page::HEADER_SIZE), slave(slave_memory.data(), slave_memory.data() + slave_memory.size()) {
 			std::random_device rd;
 			random_engine = std::mt19937(rd());
 		}
@@ -365,7 +398,7 @@ namespace db {
 			
 			mptrs.insert(iter, addr);
 			while (mptrs.size() > limit) {
-				std::uniform_int_distribution<> dis(1, static_cast<int>(size()) - 2);
+				std::uniform_int_distribution<> dis(1, static_cast<int>(mptrs.size()) - 2); // first and last stay
 				mptrs.erase(mptrs.begin() + dis(random_engine));
 			}
 		}
@@ -407,7 +440,7 @@ namespace db {
 				}
 
 				while (mptrs.size() > limit) {
-					std::uniform_int_distribution<> dis(1, static_cast<int>(size()) - 2);
+					std::uniform_int_distribution<> dis(1, static_cast<int>(mptrs.size()) - 2); // first and last stay
 					mptrs.erase(mptrs.begin() + dis(random_engine));
 				}
 			}
@@ -481,7 +514,7 @@ namespace db {
 						get(tmp_master, tmp);
 						next = tmp_master.forward_ptr;
 					}
-					if (tmp == bound) {
+					if (tmp == bound || !next) { // chain is not sorted, bound may lie behind its end
 						break;
 					}
 					tmp = next;
@@ -489,6 +522,7 @@ namespace db {
 			}
 			auto limit = system ? io_entry_page::SYSTEM_FREE_MASTER_PTRS_SIZE : io_entry_page::USER_FREE_MASTER_PTRS_SIZE;
 			get(master, addr, false);
+			master.free_slave_offsets.clear(); // still holds the offsets of the last master read
 			insert_master(mptrs, limit, addr);
 			put(master, addr);
 		}
@@ -517,6 +551,12 @@ namespace db {
 			put(entry, 0);
 		}
 
+		// entry holds the free master pointers, so it goes down with the pages
+		void sync() {
+			save();
+			sync_file();
+		}
+
 		drive_address allocate(drive_address index = 0, bool system = false) {
 			auto &mptrs = system ? entry.system_free_master_ptrs : entry.user_free_master_ptrs;
 			if (mptrs.empty()) {
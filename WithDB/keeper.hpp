@@ -1,120 +1,345 @@
 #pragma once
 
 #include "cache.hpp"
+#include "coroutine.hpp"
 #include "drive.hpp"
+#include "task_queue.hpp"
 #include "translator.hpp"
+#include "mvcc.hpp"
+#include "wal.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <condition_variable>
+#include <coroutine>
 #include <deque>
-#include <future>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace db {
-	struct keeper: cache_handler<address, page> {
-		using shared_info_pair = std::pair<keeper &, cache<address, page> &>;
-		using shared_info = std::shared_ptr<shared_info_pair>;
+	// resident addresses of cache levels, kept at the tail of metadata segment to warm up cache after restart
+	struct warmup_page : page {
+		constexpr static page_address ENTRY_COUNT_POS = 0;
+		constexpr static page_address ENTRY_SIZE = 8;
+		constexpr static page_address ENTRY_BEGIN = 8;
+		constexpr static page_address ENTRY_END = 4096;
+		constexpr static page_address ENTRY_CAPACITY = (ENTRY_END - ENTRY_BEGIN) / ENTRY_SIZE;
+
+		// page_address entry_count [0, 2)
+		// address entries [8, 4096), page aligned address carries cache level in page offset bits
+		std::vector<std::pair<address, std::size_t>> entries;
+
+	public:
+		warmup_page(iterator first, iterator last) : basic_page(first, last) {
+		}
+
+		virtual void load() {
+			auto entry_count = read<page_address>(ENTRY_COUNT_POS);
+			if (entry_count > ENTRY_CAPACITY) {
+				throw std::out_of_range("[warmup_page::load] entries are out of range");
+			}
+			entries.clear();
+			for (page_address i = 0; i != entry_count; ++i) {
+				auto value = read<address>(ENTRY_BEGIN + ENTRY_SIZE * i);
+				entries.emplace_back(value & ~(PAGE_SIZE - 1), static_cast<std::size_t>(value & (PAGE_SIZE - 1)));
+			}
+		}
 
+		virtual void dump() {
+			if (entries.size() > ENTRY_CAPACITY) {
+				throw std::out_of_range("[warmup_page::dump] entries are out of range");
+			}
+			write(static_cast<page_address>(entries.size()), ENTRY_COUNT_POS);
+			page_address i = ENTRY_BEGIN;
+			for (auto &entry : entries) {
+				write(entry.first | static_cast<address>(entry.second), i);
+				i += ENTRY_SIZE;
+			}
+		}
+	};
+
+	struct keeper: cache_handler<address, page> {
 		struct virtual_page : page {
-			using shared_iter_pair = std::shared_ptr<std::pair<iterator, iterator>>;
-			using shared_info = keeper::shared_info;
-			shared_info info;
+			keeper *owner;
+			cache<address, page> *pool;
 			address addr;
 			int pin_cnt;
+			access_enum mode; // keep access mode for reactivate
 
 		public:
-			inline virtual_page(shared_iter_pair &iter_pair, shared_info &info, address addr) :
-				page(iter_pair), info(info), addr(addr), pin_cnt(0) {
+			inline virtual_page(const page &origin, keeper *owner, cache<address, page> *pool, address addr, access_enum mode = DEFAULT_ACCESS) :
+				page(origin), owner(owner), pool(pool), addr(addr), pin_cnt(0), mode(mode) {
 			}
 
-			inline virtual_page(virtual_page &other) : page(other), info(other.info), addr(other.addr), pin_cnt(0) {
+			inline virtual_page(virtual_page &other) : page(other), owner(other.owner), pool(other.pool), addr(other.addr), pin_cnt(0), mode(other.mode) {
 			}
 
 			inline virtual_page(virtual_page &&other) :
-				page(std::move(other)), info(std::move(other.info)), addr(other.addr), pin_cnt(other.pin_cnt) {
+				page(std::move(other)), owner(other.owner), pool(other.pool), addr(other.addr), pin_cnt(other.pin_cnt), mode(other.mode) {
 				other.addr = 0;
 				other.pin_cnt = 0;
 			}
 
-			inline virtual_page(): addr(0), pin_cnt(0) {
+			inline virtual_page(): owner(nullptr), pool(nullptr), addr(0), pin_cnt(0), mode(DEFAULT_ACCESS) {
 			}
 
 			inline virtual_page &operator=(const virtual_page &other) {
 				page::operator=(other);
-				info = other.info;
+				owner = other.owner;
+				pool = other.pool;
 				addr = other.addr;
 				pin_cnt = 0;
+				mode = other.mode;
 				return *this;
 			}
 
 			inline virtual_page &operator=(virtual_page &&other)  {
 				page::operator=(std::move(other));
-				info = std::move(other.info);
+				owner = other.owner;
+				pool = other.pool;
 				addr = other.addr;
 				pin_cnt = other.pin_cnt;
+				mode = other.mode;
 				other.pin_cnt = 0;
 				return *this;
 			}
 			// TODO: lock and unlock wrapper for reactivate and pin
 			// TODO: naive way to handle page access conflicts, use reader-writer model instead
 			bool is_pinned(bool myself = false) {
-				return myself ? pin_cnt > 0 : info->second.is_pinned(addr);
+				return myself ? pin_cnt > 0 : desc && is_active() && desc->is_pinned();
 			}
 
 			bool pin() {
 				if (pin_cnt > 0) {
 					return true;
-				} else if (info->second.pin(addr)) {
+				} else if (!desc || desc->pin(generation)) { // private image has no frame to pin
 					++pin_cnt;
 					return true;
 				} else {
+					if (pool) {
+						cache_stats::add(pool->stats.pin_waits);
+					}
 					return false;
 				}
 			}
 
+			// spin until pinned, spin iterations are recorded in cache stats
+			void pin_wait() {
+				std::uint64_t spins = 0;
+				while (!pin()) {
+					++spins;
+					reactivate(); // frame may be replaced while spinning
+				}
+				if (spins && pool) {
+					cache_stats::add(pool->stats.pin_spins, spins);
+				}
+			}
+
 			void unpin() {
 				if (!pin_cnt) {
 					return;
 				}
-				if (--pin_cnt == 0) {
-					info->second.unpin(addr);
+				if (--pin_cnt == 0 && desc) {
+					desc->unpin();
+				}
+			}
+
+			// redo record for bytes [first, last) just written, page must be pinned
+			void log_range(page_address first, page_address last) {
+				if (owner) {
+					owner->log_write(addr, *this, first, last);
 				}
 			}
 
 			void reactivate() {
 				while (!is_active()) {
 					// TODO: ugly code
-					auto result = info->first.hold(addr);
-					shared_pair = std::move(result.shared_pair);
-					if (shared_pair && size() > static_cast<std::ptrdiff_t>(PAGE_SIZE)) {
-						throw std::out_of_range("[basic_page::constructor] space too large for page operation");
-					}
-					info = std::move(result.info);
+					auto result = owner->hold(addr, mode);
+					page::operator=(result);
+					pool = result.pool;
 					pin_cnt = result.pin_cnt;
+					result.pin_cnt = 0;
 				}
 			}
 		};
 
+		// snapshot of keeper behaviour, levels are indexed as caches and scan ring is the last one
+		struct keeper_stats {
+			std::vector<cache_counter> levels;
+			std::uint64_t tasks = 0;
+			std::uint64_t task_wait_ns = 0; // total time tasks wait in queue before execution
+			std::uint64_t task_wait_max_ns = 0;
+			std::uint64_t fast_holds = 0; // resident holds served on the caller thread
+			std::uint64_t log_flushes = 0;
+			std::uint64_t checkpoints = 0;
+			std::uint64_t shadow_commits = 0;
+		};
+
 		drive io;
 		translator trans;
+		wal log;
+		version_store versions; // tuple versions for snapshot reads
 		std::vector<cache<address, page>> caches;
-		std::vector<shared_info> infos;
 
-		explicit keeper(const char * filename, bool trunc = false) : io(filename, trunc), trans(io) {
+		explicit keeper(const char * filename, bool trunc = false) : io(filename, trunc), trans(io), log(std::string(filename) + ".wal", trunc),
+			requests(new keeper_request[KEEPER_REQUEST_SLOTS]), free_slots(KEEPER_REQUEST_SLOTS), pending(KEEPER_REQUEST_SLOTS) {
+			for (std::uint32_t i = 0; i != KEEPER_REQUEST_SLOTS; ++i) {
+				free_slots.push(i);
+			}
+			recover();
+			checkpoint_lsn = log.last_lsn();
 		}
 
 		explicit keeper(const std::string &filename, bool trunc = false) : keeper(filename.c_str(), trunc) {
 		}
 
+		// everything is in database file after close, log is dropped
 		void close() {
 			save();
+			save_warmup();
 			trans.close();
+			io.sync(); // pages and allocator entry are on disk before the log is dropped
 			io.close();
+			log.truncate();
+			log.close();
+		}
+
+		// make every logged change durable
+		void sync() {
+			log.flush();
+		}
+
+		// shadow paging: written back pages go to fresh drive pages and commit publishes them all with a new translator root
+		// a crash falls back to the last published root, so page writes are not logged, transaction intents still are
+		std::atomic<bool> shadow = false;
+		std::mutex commit_mutex;
+		std::atomic<std::uint64_t> shadow_commit_cnt = 0;
+
+		// switch while no transaction runs, everything is written in place and the log is dropped first
+		// so recovery never replays a page write over a page moved by shadow mode
+		// workers keep running, frames are written back through the cache latch, caller holds no page
+		void set_shadow(bool on) {
+			{
+				std::unique_lock<std::mutex> lock(txn_mutex);
+				if (!txn_first_lsn.empty()) {
+					throw std::runtime_error("[keeper::set_shadow] transactions are running");
+				}
+			}
+			std::unique_lock<std::mutex> commit_lock(commit_mutex);
+			write_back_all();
+			std::unique_lock<std::mutex> lock(io_mutex);
+			trans.set_shadow(on);
+			io.sync();
+			log.truncate();
+			shadow = on;
+		}
+
+		// shadow mode: every dirty page is written back and then published at once, a log sync otherwise
+		// caller holds no page, a latched page is waited for
+		void commit() {
+			if (!shadow) {
+				sync();
+				return;
+			}
+			std::unique_lock<std::mutex> commit_lock(commit_mutex);
+			write_back_all();
+			std::unique_lock<std::mutex> lock(io_mutex);
+			trans.save(); // syncs pages before it writes the root
+			io.sync(); // and the root before commit returns
+			shadow_commit_cnt.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// every dirty frame reaches drive, a latched frame is waited for, pages it wrote later stay dirty
+		// a frame pinned past KEEPER_WRITE_BACK_WAIT fails the call, frames written so far are only published by a later commit
+		void write_back_all() {
+			log.flush(); // log before pages, intents before the pages they explain
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(KEEPER_WRITE_BACK_WAIT);
+			for (auto &cache : caches) {
+				for (std::size_t i = 0; i != cache.frames.size(); ++i) {
+					while (!cache.flush(i) && cache.frames[i].dirty.load()) {
+						if (std::chrono::steady_clock::now() >= deadline) {
+							throw std::runtime_error("[keeper::write_back_all] dirty frame stays pinned");
+						}
+						std::this_thread::yield();
+					}
+				}
+				cache.wait_writes();
+			}
+		}
+
+		// read-only view of the last shadow commit, its pages stay on drive until the view ends
+		struct shadow_snapshot {
+			keeper *owner;
+			root_snapshot root;
+
+		public:
+			explicit shadow_snapshot(keeper &owner) : owner(&owner), root(owner.pin_root()) {
+			}
+
+			shadow_snapshot(const shadow_snapshot &other) = delete;
+			shadow_snapshot &operator=(const shadow_snapshot &other) = delete;
+
+			~shadow_snapshot() {
+				owner->unpin_root(root);
+			}
+
+			// page as committed, a page missing from the root reads as empty
+			void get(address addr, page &value) {
+				std::unique_lock<std::mutex> lock(owner->io_mutex);
+				try {
+					owner->io.get(value, owner->trans(root, addr));
+				} catch (const std::runtime_error &) {
+					value.clear();
+				}
+			}
+		};
+
+		// segment of a new table or index, pages of it go to cache level
+		address create_segment(segment_enum seg, std::size_t level) {
+			if (level >= KEEPER_CACHE_LEVEL) {
+				throw std::out_of_range("[keeper::create_segment] cache level is out of range");
+			}
+			std::unique_lock<std::mutex> lock(io_mutex);
+			auto addr = trans.create_segment(seg, level);
+			if (!shadow) {
+				log.append_segment(addr, seg, level);
+			}
+			return addr;
+		}
+
+		// one past the last page of the segment holding addr that is resident in a cache or linked on drive
+		// caches go first, a page leaving them is linked by its write back before the translator is asked
+		// so a page written before the call is counted, pages past the extent have never been written
+		address segment_extent(address addr) {
+			auto first = (addr / SEGMENT_SIZE) * SEGMENT_SIZE;
+			auto ret = first;
+			for (auto &cache : caches) {
+				ret = std::max(ret, cache.resident_end(first, first + SEGMENT_SIZE));
+			}
+			std::unique_lock<std::mutex> lock(io_mutex);
+			return std::max(ret, trans.linked_end(addr));
+		}
+
+		root_snapshot pin_root() {
+			std::unique_lock<std::mutex> lock(io_mutex);
+			return trans.pin();
+		}
+
+		void unpin_root(const root_snapshot &root) {
+			std::unique_lock<std::mutex> lock(io_mutex);
+			trans.unpin(root);
 		}
 
 		// TODO: schedule clean when keeper thread is free for a long time
@@ -123,20 +348,176 @@ namespace db {
 		}
 
 		void save() {
+			log.flush(); // log before pages
 			for (auto &cache : caches) {
 				// TODO: get rid of direct access
 				for (auto &pair : cache.position_map) {
-					page tmp(cache.ptrs[pair.second]);
+					auto &f = cache.frames[pair.second];
+					if (!f.dirty.exchange(false)) {
+						continue;
+					}
+					f.page_lsn = 0;
+					f.rec_lsn = 0;
+					auto tmp = cache.frame_page(pair.second);
 					soft_put(pair.first, tmp);
+					cache_stats::add(cache.stats.write_backs);
+				}
+			}
+		}
+
+		// redo every logged change in order, make them durable in database file and drop the log
+		// page writes are physiological and idempotent, so replaying changes already on drive is harmless
+		void recover() {
+			auto records = log.read_all();
+			// a log cut by truncate holds only its checkpoint record, read_all has already cut any torn tail
+			if (std::all_of(records.begin(), records.end(), [](const log_record &record) {
+				return record.type == LOG_CHECKPOINT;
+			})) {
+				return;
+			}
+			// records before redo start of the last checkpoint are already on drive
+			std::uint64_t redo = 0;
+			for (auto &record : records) {
+				if (record.type == LOG_CHECKPOINT) {
+					redo = record.get_redo_lsn();
+				}
+			}
+			std::unordered_map<address, std::vector<char>> images;
+			std::unordered_set<address> unlinked; // page written after unlink starts from a clean image
+			std::map<std::uint64_t, std::vector<txn_intent>> unfinished; // a checkpoint never drops the log of a running transaction
+			for (auto &record : records) {
+				if (record.lsn <= redo) {
+					continue;
+				}
+				auto addr = record.get_address();
+				switch (record.type) {
+				case LOG_CHECKPOINT:
+					break;
+				case LOG_TXN_INSERT:
+				case LOG_TXN_ERASE:
+					unfinished[record.get_txn()].push_back(txn_intent{ record.type, record.get_txn_address() });
+					break;
+				case LOG_TXN_COMMIT:
+				case LOG_TXN_ABORT:
+					unfinished.erase(record.get_txn());
+					break;
+				case LOG_SEGMENT:
+					try {
+						trans.find_segment_index(addr);
+					} catch (const std::out_of_range &) {
+						trans.add_segment(record.get_segment(), addr, record.get_cache_level());
+					}
+					break;
+				case LOG_LINK:
+					try {
+						trans(addr);
+					} catch (const std::runtime_error &) {
+						trans.link(addr, record.get_drive_address());
+					}
+					break;
+				case LOG_UNLINK:
+					images.erase(addr);
+					unlinked.insert(addr);
+					try {
+						trans.unlink(addr);
+					} catch (const std::runtime_error &) {
+						// unlink reached translator before crash
+					}
+					break;
+				case LOG_PAGE_WRITE: {
+					auto iter = images.find(addr);
+					if (iter == images.end()) {
+						iter = images.emplace(addr, std::vector<char>(PAGE_SIZE)).first;
+						if (unlinked.find(addr) == unlinked.end()) {
+							page tmp(iter->second.data(), iter->second.data() + PAGE_SIZE);
+							soft_get(addr, tmp);
+						}
+					}
+					auto offset = record.get_offset();
+					if (offset + (record.bytes_end() - record.bytes_begin()) > static_cast<std::ptrdiff_t>(PAGE_SIZE)) {
+						throw std::runtime_error("[keeper::recover] page write is out of page range");
+					}
+					std::copy(record.bytes_begin(), record.bytes_end(), iter->second.begin() + offset);
+					break;
 				}
+				default:
+					throw std::runtime_error("[keeper::recover] unknown log record");
+				}
+			}
+			for (auto &pair : images) {
+				page tmp(pair.second.data(), pair.second.data() + PAGE_SIZE);
+				soft_put(pair.first, tmp);
+			}
+			trans.save();
+			io.sync();
+			log.truncate();
+			// pages now hold every change of unfinished transactions, they are logged again and wait for abort
+			for (auto &pair : unfinished) {
+				auto txn = begin_txn();
+				for (auto &intent : pair.second) {
+					log.append_txn(intent.type, txn, intent.addr);
+				}
+				losers.emplace_back(txn, std::move(pair.second));
+			}
+			log.flush();
+		}
+
+		// transaction bookkeeping, tuple changes and their undo live in transaction.hpp
+		struct txn_intent {
+			log_record_enum type; // LOG_TXN_INSERT or LOG_TXN_ERASE
+			address addr;
+		};
+
+		std::vector<std::pair<std::uint64_t, std::vector<txn_intent>>> losers; // unfinished before restart, to be aborted
+		std::atomic<std::uint64_t> txn_clock = 0;
+		std::mutex txn_mutex;
+		std::map<std::uint64_t, std::uint64_t> txn_first_lsn; // running transactions and where their log starts
+
+		std::uint64_t begin_txn() {
+			auto txn = txn_clock.fetch_add(1) + 1;
+			std::unique_lock<std::mutex> lock(txn_mutex);
+			txn_first_lsn.emplace(txn, log.last_lsn());
+			return txn;
+		}
+
+		// intent goes to log before the page write it explains
+		void log_txn(log_record_enum type, std::uint64_t txn, address addr) {
+			log.append_txn(type, txn, addr);
+		}
+
+		// commit record is forced together with whatever other committers appended meanwhile, one sync for all
+		// abort needs no force, a later commit or page write back forces it anyway
+		// in shadow mode pages are published before the commit record, a crash in between undoes the transaction
+		void end_txn(std::uint64_t txn, bool committed) {
+			if (committed && shadow) {
+				commit();
+			}
+			auto lsn = log.append_txn(committed ? LOG_TXN_COMMIT : LOG_TXN_ABORT, txn);
+			if (committed) {
+				log.flush(lsn);
+			}
+			std::unique_lock<std::mutex> lock(txn_mutex);
+			txn_first_lsn.erase(txn);
+		}
+
+		std::uint64_t oldest_txn_lsn() {
+			std::unique_lock<std::mutex> lock(txn_mutex);
+			auto ret = std::numeric_limits<std::uint64_t>::max();
+			for (auto &pair : txn_first_lsn) {
+				ret = std::min(ret, pair.second);
 			}
+			return ret;
 		}
 
+		// drive and translator mapping are shared by all workers, disk io is serialized here
+		std::mutex io_mutex;
+
 		void soft_get(address addr, page &value) {
+			std::unique_lock<std::mutex> lock(io_mutex);
 			try {
 				auto alloc = trans(addr);
 				io.get(value, alloc);
-			} catch (std::runtime_error e) {
+			} catch (const std::runtime_error &) {
 				value.clear();
 			}
 		}
@@ -145,19 +526,62 @@ namespace db {
 			if (!value.is_active()) {
 				return;
 			}
+			std::unique_lock<std::mutex> lock(io_mutex);
 			drive_address alloc;
+			if (shadow) {
+				io.put(value, trans.place(addr));
+				write_epoch.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
 			try {
 				alloc = trans(addr);
-			} catch (std::runtime_error e) {
+			} catch (const std::runtime_error &) {
 				alloc = io.allocate();
 				trans.link(addr, alloc);
+				log.append_link(addr, alloc);
 			}
 			io.put(value, alloc);
+			write_epoch.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// pages read ahead by hold_many on the current worker, taken by cache_insert instead of the drive
+		struct read_batch {
+			std::vector<char> memory;
+			std::unordered_map<address, std::size_t> offsets;
+			std::uint64_t write_epoch = 0; // staged pages are stale once anything is written back
+		};
+
+		std::atomic<std::uint64_t> write_epoch = 0;
+
+		static read_batch *&current_batch() {
+			thread_local read_batch *batch = nullptr;
+			return batch;
+		}
+
+		bool load_staged(address addr, page &value) {
+			auto batch = current_batch();
+			if (!batch || batch->write_epoch != write_epoch.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			auto iter = batch->offsets.find(addr);
+			if (iter == batch->offsets.end()) {
+				return false;
+			}
+			auto src = batch->memory.data() + iter->second;
+			std::copy(src, src + PAGE_SIZE, value.begin());
+			value.load();
+			return true;
 		}
 
 		// auto load and save
 		virtual bool cache_insert(address addr, page &value) {
-			soft_get(addr, value);
+			// page evicted from another level or the scan ring may still be on its way to drive
+			for (auto &cache : caches) {
+				cache.wait_written(addr);
+			}
+			if (!load_staged(addr, value)) {
+				soft_get(addr, value);
+			}
 			return true;
 		}
 
@@ -166,137 +590,902 @@ namespace db {
 			return true;
 		}
 
-		// TODO: replace tasks with promise and argument calling list ?
-		// TODO: design or use lock-free deque data structure
-		std::deque<std::packaged_task<virtual_page()>> tasks;
-		std::mutex tasks_mutex;
-		std::condition_variable tasks_not_empty;
-		bool start_flag;
+		// write-ahead rule, page never reaches drive before its log records
+		// write-ahead rule: a page leaving the cache forces the log up to its last record, a transaction larger than
+		// its cache level pays about one flush per level of evictions, the flush takes the whole buffer along
+		// and victim prefers frames already durable, so the evictions behind it force nothing
+		virtual bool cache_write_back(address addr, page &value, std::uint64_t lsn) {
+			log.flush(lsn);
+			soft_put(addr, value);
+			return true;
+		}
+
+		virtual std::uint64_t cache_durable_lsn() {
+			return log.flushed_lsn();
+		}
+
+		// physiological redo record of a held page, dirty frame remembers it for the write-ahead rule
+		void log_write(address addr, page &value, page_address first, page_address last) {
+			if (first >= last || shadow) {
+				return;
+			}
+			auto desc = value.get_frame();
+			if (desc) {
+				desc->mark_logging(log.last_lsn());
+			}
+			auto lsn = log.append_write(addr, first, value.begin() + first, value.begin() + last);
+			if (desc) {
+				desc->mark_logged(lsn);
+			}
+			if (lsn - checkpoint_lsn.load(std::memory_order_relaxed) >= KEEPER_CHECKPOINT_LOG_SIZE) {
+				checkpoint_async();
+			}
+		}
+
+		// fuzzy checkpoint: translator and drive state are saved at begin, dirty frames are written back by small
+		// background steps that foreground requests preempt, pinned frames are left dirty
+		// the end record keeps the oldest change not on drive yet, log before it is dropped
+		std::atomic<bool> checkpointing = false;
+		std::atomic<std::uint64_t> checkpoint_lsn = 0; // begin of the last finished checkpoint
+		std::atomic<std::uint64_t> checkpoint_cnt = 0;
+
+		// false when a checkpoint is already running
+		bool checkpoint_async() {
+			bool expected = false;
+			if (!checkpointing.compare_exchange_strong(expected, true)) {
+				return false;
+			}
+			add_background([this]() { this->checkpoint_begin(); });
+			return true;
+		}
+
+		void checkpoint_begin() {
+			std::uint64_t begin;
+			try {
+				std::unique_lock<std::mutex> lock(io_mutex);
+				begin = log.last_lsn(); // link and unlink are logged under io_mutex, so the saved state covers every record before
+				trans.save();
+				io.save();
+			} catch (...) {
+				checkpointing = false;
+				throw;
+			}
+			checkpoint_step(0, 0, begin);
+		}
+
+		void checkpoint_step(std::size_t level, std::size_t index, std::uint64_t begin) {
+			try {
+				auto &cache = caches[level];
+				auto end = std::min(index + KEEPER_CHECKPOINT_BATCH, cache.frames.size());
+				for (; index != end; ++index) {
+					cache.flush(index);
+				}
+				if (index == cache.frames.size()) {
+					++level;
+					index = 0;
+				}
+			} catch (...) {
+				checkpointing = false;
+				throw;
+			}
+			if (level == caches.size()) {
+				add_background([this, begin]() { this->checkpoint_end(begin); });
+			} else {
+				add_background([this, level, index, begin]() { this->checkpoint_step(level, index, begin); });
+			}
+		}
+
+		void checkpoint_end(std::uint64_t begin) {
+			try {
+				auto redo = std::min(begin, oldest_txn_lsn());
+				for (auto &cache : caches) {
+					redo = std::min(redo, cache.min_rec_lsn());
+				}
+				{
+					// pages counted clean above and the allocator entry must be on disk before the log behind redo goes
+					std::unique_lock<std::mutex> lock(io_mutex);
+					io.sync();
+				}
+				log.append_checkpoint(redo);
+				log.flush();
+				log.discard(redo);
+				checkpoint_lsn = begin;
+				checkpoint_cnt.fetch_add(1, std::memory_order_relaxed);
+			} catch (...) {
+				checkpointing = false;
+				throw;
+			}
+			checkpointing = false;
+		}
+
+		enum request_enum { HOLD_REQUEST, HOLD_MANY_REQUEST, LOOSEN_REQUEST };
+
+		// preallocated request slot, only its index travels through the rings
+		struct keeper_request {
+			request_enum kind = HOLD_REQUEST;
+			address addr = 0;
+			access_enum mode = DEFAULT_ACCESS;
+			std::chrono::steady_clock::time_point queued_at;
+			virtual_page result;
+			std::vector<address> batch; // capacity is kept across requests
+			std::vector<virtual_page> results;
+			std::exception_ptr error;
+			std::coroutine_handle<> continuation;
+			completion finished;
+		};
+
+		// result of an asynchronous request, the slot goes back to the pool once the result is taken
+		template <typename Result>
+		struct basic_future {
+			keeper *owner;
+			std::uint32_t slot;
+
+		public:
+			basic_future() : owner(nullptr), slot(0) {
+			}
+
+			basic_future(keeper *owner, std::uint32_t slot) : owner(owner), slot(slot) {
+			}
+
+			basic_future(const basic_future &other) = delete;
+
+			basic_future(basic_future &&other) : owner(other.owner), slot(other.slot) {
+				other.owner = nullptr;
+			}
+
+			basic_future &operator=(const basic_future &other) = delete;
+
+			basic_future &operator=(basic_future &&other) {
+				if (this != &other) {
+					abandon();
+					owner = other.owner;
+					slot = other.slot;
+					other.owner = nullptr;
+				}
+				return *this;
+			}
+
+			~basic_future() {
+				abandon();
+			}
+
+			inline bool valid() const {
+				return owner != nullptr;
+			}
+
+			inline bool is_ready() const {
+				return owner && owner->requests[slot].finished.is_done();
+			}
+
+			void wait() {
+				if (!owner) {
+					throw std::runtime_error("[keeper::basic_future::wait] future has no state");
+				}
+				owner->requests[slot].finished.wait();
+			}
+
+			Result get() {
+				wait();
+				auto &request = owner->requests[slot];
+				auto error = request.error;
+				Result result;
+				if constexpr (std::is_same_v<Result, virtual_page>) {
+					result = std::move(request.result);
+				} else {
+					result = std::move(request.results);
+				}
+				owner->release_request(slot);
+				owner = nullptr;
+				if (error) {
+					std::rethrow_exception(error);
+				}
+				return result;
+			}
+
+		private:
+			// slot can not be reused before the worker finishes it
+			void abandon() {
+				if (owner) {
+					owner->requests[slot].finished.wait();
+					owner->release_request(slot);
+					owner = nullptr;
+				}
+			}
+		};
+
+		using request_future = basic_future<virtual_page>;
+		using batch_future = basic_future<std::vector<virtual_page>>;
+
+		// request issued when a coroutine suspends, parked without a thread while every slot is in flight
+		struct slot_waiter {
+			request_enum kind;
+			address addr;
+			access_enum mode;
+			const address *first;
+			const address *last;
+			std::coroutine_handle<> continuation;
+			std::uint32_t slot;
+		};
+
+		// co_await keeper.co_hold(addr) suspends the coroutine instead of blocking a thread
+		// the coroutine must stay alive until it is resumed
+		template <typename Result>
+		struct request_awaiter : slot_waiter {
+			keeper *owner;
+
+		public:
+			request_awaiter(keeper *owner, request_enum kind, address addr, access_enum mode, const address *first = nullptr, const address *last = nullptr) :
+				slot_waiter{ kind, addr, mode, first, last, nullptr, 0 }, owner(owner) {
+			}
+
+			// resident page needs no suspension at all
+			bool await_ready() {
+				if constexpr (std::is_same_v<Result, virtual_page>) {
+					resident = owner->try_hold(addr, mode, held);
+					return resident;
+				} else {
+					return false;
+				}
+			}
+
+			// resumption may run on another thread before this returns, nothing touches the frame after issue
+			void await_suspend(std::coroutine_handle<> handle) {
+				continuation = handle;
+				owner->issue(this);
+			}
+
+			Result await_resume() {
+				if constexpr (std::is_same_v<Result, virtual_page>) {
+					if (resident) {
+						return std::move(held);
+					}
+				}
+				return basic_future<Result>(owner, slot).get();
+			}
+
+		private:
+			virtual_page held;
+			bool resident = false;
+		};
+
+		// request slots are recycled through free_slots, pending carries queued slots to workers
+		// both rings can hold every slot so push never waits for long
+		std::unique_ptr<keeper_request[]> requests;
+		mpmc_ring<std::uint32_t> free_slots;
+		mpmc_ring<std::uint32_t> pending;
+		event_count pending_event;
+		event_count free_event;
+		// low priority work like warm-up, only executed when no foreground request is waiting
+		std::deque<std::function<void()>> background;
+		std::mutex background_mutex;
+		std::unordered_set<address> prefetch_pending; // hinted pages not loaded yet, guarded by background_mutex
+		std::atomic<bool> has_prefetch = false;
+		std::atomic<std::uint64_t> task_cnt = 0;
+		std::atomic<std::uint64_t> task_wait_ns = 0;
+		std::atomic<std::uint64_t> task_wait_max_ns = 0;
+		std::atomic<std::uint64_t> fast_cnt = 0;
+		std::chrono::steady_clock::time_point stats_logged_at;
+		std::atomic<bool> start_flag = false;
 		std::mutex start_flag_mutex;
 		
 		// TODO: segment retrieve and management
 
-		virtual_page hold_func(address addr) {
-			auto level = segment_cache_level(trans.find_seg(addr));
+		// scan access only reuses frames in scan ring when the page is not resident in main cache
+		// ring page is promoted to main cache once it is held by default access and not pinned
+		std::size_t hold_level(address addr, access_enum mode) {
+			auto level = trans.find_cache_level(addr);
+			auto &ring = caches[KEEPER_SCAN_RING];
+			if (mode == SCAN_ACCESS) {
+				return caches[level].contains(addr) ? level : KEEPER_SCAN_RING;
+			}
+			if (ring.contains(addr) && !ring.erase(addr)) {
+				return KEEPER_SCAN_RING; // pinned by scan
+			}
+			return level;
+		}
+
+		// choosing a cache and loading into it is one step per address, otherwise a scan and a writer
+		// racing on a miss would load the page into ring and level both and diverge
+		std::mutex placement[KEEPER_PLACEMENT_STRIPES];
+
+		inline std::mutex &placement_of(address addr) {
+			return placement[(addr >> PAGE_BIT_LENGTH) % KEEPER_PLACEMENT_STRIPES];
+		}
+
+		// page already resident anywhere is left where it is, scan access prefetches into ring
+		void prefetch_func(address addr, access_enum mode) {
+			if (!take_prefetch(addr)) {
+				return; // held before the hint came up, loading it now would only evict something
+			}
+			std::unique_lock<std::mutex> lock(placement_of(addr));
+			auto level = trans.find_cache_level(addr);
+			auto &ring = caches[KEEPER_SCAN_RING];
+			if (caches[level].contains(addr) || ring.contains(addr)) {
+				return;
+			}
+			bool full = false;
+			(mode == SCAN_ACCESS ? ring : caches[level]).get(addr, true, &full); // no hint is worth waiting for a pinned ring
+		}
+
+		bool take_prefetch(address addr) {
+			if (!has_prefetch.load(std::memory_order_relaxed)) {
+				return false;
+			}
+			std::unique_lock<std::mutex> lock(background_mutex);
+			auto ret = prefetch_pending.erase(addr) != 0;
+			has_prefetch.store(!prefetch_pending.empty(), std::memory_order_relaxed);
+			return ret;
+		}
+
+		// scan pages never spill into a cache level, a ring pinned full by other scans is waited for
+		virtual_page hold_func(address addr, access_enum mode = DEFAULT_ACCESS) {
+			take_prefetch(addr);
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(KEEPER_SCAN_RING_WAIT);
+			virtual_page ret;
+			while (!ring_hold(addr, mode, ret)) {
+				if (std::chrono::steady_clock::now() >= deadline) {
+					throw std::runtime_error("[keeper::hold_func] scan ring stays pinned");
+				}
+				std::this_thread::yield();
+			}
+			return ret;
+		}
+
+		// false when every ring frame is pinned by running scans
+		bool ring_hold(address addr, access_enum mode, virtual_page &out) {
+			std::unique_lock<std::mutex> lock(placement_of(addr));
+			auto level = hold_level(addr, mode);
+			bool full = false;
+			auto tmp = caches[level].get(addr, false, level == KEEPER_SCAN_RING ? &full : nullptr);
+			if (full) {
+				return false;
+			}
 			auto &cache = caches[level];
-			auto tmp = cache.get(addr);
-			virtual_page tmp_page(tmp.shared_pair, infos[level], addr);
-			tmp_page.pin();
-			return std::move(tmp_page);
+			lock.unlock();
+			out = virtual_page(tmp, this, &cache, addr, mode);
+			out.pin();
+			return true;
+		}
+
+		// misses of a batch are translated under one io lock and read in physical order with one sync
+		// every page stays pinned until the caller loads it, a batch finding the ring pinned full by other scans
+		// lets go of its pages and starts over so two half held batches never wait on each other
+		void hold_many_func(const std::vector<address> &addrs, access_enum mode, std::vector<virtual_page> &out) {
+			struct miss_item {
+				drive_address ptr;
+				address addr;
+			};
+			std::vector<miss_item> misses;
+			for (auto addr : addrs) {
+				take_prefetch(addr);
+				auto level = trans.find_cache_level(addr);
+				if (!caches[level].contains(addr) && !caches[KEEPER_SCAN_RING].contains(addr)) {
+					misses.push_back(miss_item{ 0, addr });
+				}
+			}
+
+			read_batch batch;
+			if (!misses.empty()) {
+				std::unique_lock<std::mutex> lock(io_mutex);
+				batch.write_epoch = write_epoch.load(std::memory_order_relaxed);
+				auto last = std::remove_if(misses.begin(), misses.end(), [this](miss_item &item) {
+					try {
+						item.ptr = trans(item.addr);
+						return false;
+					} catch (const std::runtime_error &) {
+						return true; // not linked yet, cache_insert clears it
+					}
+				});
+				misses.erase(last, misses.end());
+				std::sort(misses.begin(), misses.end(), [](const miss_item &a, const miss_item &b) {
+					return a.ptr < b.ptr;
+				});
+				batch.memory.resize(misses.size() * PAGE_SIZE);
+				for (std::size_t i = 0; i != misses.size(); ++i) {
+					auto offset = i * PAGE_SIZE;
+					page tmp(batch.memory.data() + offset, batch.memory.data() + offset + PAGE_SIZE);
+					io.get(tmp, misses[i].ptr, false, i == 0);
+					batch.offsets.emplace(misses[i].addr, offset);
+				}
+			}
+
+			out.clear();
+			current_batch() = &batch;
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(KEEPER_SCAN_RING_WAIT);
+			try {
+				for (std::size_t i = 0; i != addrs.size();) {
+					out.emplace_back();
+					if (ring_hold(addrs[i], mode, out.back())) {
+						++i;
+						continue;
+					}
+					out.pop_back();
+					for (auto &held : out) {
+						held.unpin();
+					}
+					out.clear();
+					i = 0;
+					if (std::chrono::steady_clock::now() >= deadline) {
+						throw std::runtime_error("[keeper::hold_many_func] scan ring stays pinned");
+					}
+					std::this_thread::yield();
+				}
+			} catch (...) {
+				current_batch() = nullptr;
+				for (auto &held : out) {
+					held.unpin();
+				}
+				out.clear();
+				throw;
+			}
+			current_batch() = nullptr;
 		}
 
 		virtual_page loosen_func(address addr) {
-			auto level = segment_cache_level(trans.find_seg(addr));
+			std::unique_lock<std::mutex> placement_lock(placement_of(addr));
+			auto level = hold_level(addr, DEFAULT_ACCESS);
 			auto &cache = caches[level];
 			auto tmp = cache.get(addr);
+			placement_lock.unlock();
 			soft_put(addr, tmp); // TODO: have to write back a soft get page for unlink, stupid
+			std::unique_lock<std::mutex> lock(io_mutex);
+			if (!shadow) {
+				log.append_unlink(addr);
+			}
 			trans.unlink(addr);
 			return virtual_page();
 		}
 
-		void thread_execute() {
-			std::unique_lock<std::mutex> lock(tasks_mutex);
-			int counter = 0;
-			while (tasks.empty()) {
-				if (counter++ == 6) {
-					return; // check if finished
+		constexpr static std::size_t WARMUP_PAGE_COUNT = (KEEPER_CACHE_TOTAL_SIZE + warmup_page::ENTRY_CAPACITY - 1) / warmup_page::ENTRY_CAPACITY;
+
+		// warm-up pages take the last pages of metadata segment
+		inline static address warmup_address(std::size_t index) {
+			return default_segment_address(METADATA_SEG) + SEGMENT_SIZE - (WARMUP_PAGE_COUNT - index) * PAGE_SIZE;
+		}
+
+		// persist resident addresses per level from the most recent one, scan ring is not worth warming
+		void save_warmup() {
+			if (caches.empty()) {
+				return;
+			}
+			std::vector<std::pair<address, std::size_t>> entries;
+			for (std::size_t level = 0; level != KEEPER_CACHE_LEVEL; ++level) {
+				for (auto addr : caches[level].recency()) {
+					entries.emplace_back(addr, level);
+				}
+			}
+			std::vector<char> memory(PAGE_SIZE);
+			warmup_page tmp(memory.data(), memory.data() + PAGE_SIZE);
+			auto iter = entries.begin();
+			for (std::size_t i = 0; i != WARMUP_PAGE_COUNT; ++i) {
+				auto count = std::min<std::size_t>(warmup_page::ENTRY_CAPACITY, entries.end() - iter);
+				tmp.entries.assign(iter, iter + count);
+				iter += count;
+				soft_put(warmup_address(i), tmp);
+			}
+		}
+
+		// read warm-up list and queue prefetch in physical order, recency is restored after loading
+		void load_warmup() {
+			struct warmup_item {
+				drive_address ptr;
+				address addr;
+				timestamp accessAt;
+			};
+			std::vector<char> memory(PAGE_SIZE);
+			warmup_page tmp(memory.data(), memory.data() + PAGE_SIZE);
+			std::vector<warmup_item> items;
+			std::vector<timestamp> ranks(KEEPER_CACHE_LEVEL, current_timestamp());
+			for (std::size_t i = 0; i != WARMUP_PAGE_COUNT; ++i) {
+				tmp.entries.clear();
+				soft_get(warmup_address(i), tmp);
+				for (auto &entry : tmp.entries) {
+					if (entry.second >= KEEPER_CACHE_LEVEL) {
+						continue;
+					}
+					try {
+						std::unique_lock<std::mutex> lock(io_mutex); // translation may read a radix node
+						items.push_back(warmup_item{ trans(entry.first), entry.first, ranks[entry.second]-- });
+					} catch (const std::runtime_error &) {
+						// page is loosened after saving
+					}
+				}
+			}
+			std::sort(items.begin(), items.end(), [](const warmup_item &a, const warmup_item &b) {
+				return a.ptr < b.ptr;
+			});
+			for (auto &item : items) {
+				add_background([this, addr = item.addr, accessAt = item.accessAt]() {
+					this->warmup_func(addr, accessAt);
+				});
+			}
+		}
+
+		// never evict for warm-up, page held by foreground before warm-up keeps its own recency
+		void warmup_func(address addr, timestamp accessAt) {
+			std::unique_lock<std::mutex> lock(placement_of(addr));
+			auto &cache = caches[trans.find_cache_level(addr)];
+			if (cache.contains(addr) || caches[KEEPER_SCAN_RING].contains(addr) || cache.is_full()) {
+				return;
+			}
+			cache.get(addr);
+			cache.touch(addr, accessAt);
+		}
+
+		void execute(std::uint32_t slot) {
+			auto &request = requests[slot];
+			record_wait(request.queued_at);
+			try {
+				if (request.kind == HOLD_REQUEST) {
+					request.result = hold_func(request.addr, request.mode);
+				} else if (request.kind == HOLD_MANY_REQUEST) {
+					hold_many_func(request.batch, request.mode, request.results);
+				} else {
+					request.result = loosen_func(request.addr);
+				}
+			} catch (...) {
+				request.error = std::current_exception();
+			}
+			complete(slot);
+		}
+
+		// coroutines resume on the executor when set, otherwise on the worker completing the request
+		executor *resumer = nullptr;
+
+		void set_executor(executor *exec) {
+			resumer = exec;
+		}
+
+		// slot may be released by the waiter as soon as it is done, except for a suspended coroutine
+		void complete(std::uint32_t slot) {
+			auto &request = requests[slot];
+			if (request.finished.done()) {
+				auto continuation = request.continuation;
+				if (resumer) {
+					resumer->post(continuation);
+				} else {
+					continuation.resume();
 				}
-				using namespace std::chrono_literals;
-				tasks_not_empty.wait_for(lock, 500ms);
 			}
-			
-			auto tmp = std::move(tasks.front());
-			tasks.pop_front();
+		}
+
+		bool execute_background() {
+			std::unique_lock<std::mutex> lock(background_mutex);
+			if (background.empty()) {
+				return false;
+			}
+			auto func = std::move(background.front());
+			background.pop_front();
 			lock.unlock();
-			tmp();
+			try {
+				func();
+			} catch (const std::exception &) {
+				// background work is only a hint
+			} catch (...) {
+				// nor is anything else it throws, the worker must survive it
+			}
+			return true;
+		}
+
+		bool has_background() {
+			std::unique_lock<std::mutex> lock(background_mutex);
+			return !background.empty();
+		}
+
+		void record_wait(std::chrono::steady_clock::time_point queued_at) {
+			auto wait = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - queued_at).count());
+			task_cnt.fetch_add(1, std::memory_order_relaxed);
+			task_wait_ns.fetch_add(wait, std::memory_order_relaxed);
+			auto max = task_wait_max_ns.load(std::memory_order_relaxed);
+			while (wait > max && !task_wait_max_ns.compare_exchange_weak(max, wait, std::memory_order_relaxed)) {
+			}
+		}
+
+		keeper_stats stats() {
+			keeper_stats ret;
+			for (auto &cache : caches) {
+				ret.levels.push_back(cache.stats.snapshot());
+			}
+			ret.tasks = task_cnt.load(std::memory_order_relaxed);
+			ret.task_wait_ns = task_wait_ns.load(std::memory_order_relaxed);
+			ret.task_wait_max_ns = task_wait_max_ns.load(std::memory_order_relaxed);
+			ret.fast_holds = fast_cnt.load(std::memory_order_relaxed);
+			{
+				std::unique_lock<std::mutex> lock(log.latch);
+				ret.log_flushes = log.flush_cnt;
+			}
+			ret.checkpoints = checkpoint_cnt.load(std::memory_order_relaxed);
+			ret.shadow_commits = shadow_commit_cnt.load(std::memory_order_relaxed);
+			return ret;
+		}
+
+		void log_stats(std::ostream &os) {
+			auto s = stats();
+			os << std::dec << "[keeper::stats]";
+			for (std::size_t i = 0; i != s.levels.size(); ++i) {
+				auto &c = s.levels[i];
+				os << (i == KEEPER_SCAN_RING ? " ring" : " level") << (i == KEEPER_SCAN_RING ? "" : std::to_string(i))
+					<< " {hit " << c.hits << ", miss " << c.misses << ", evict " << c.evictions
+					<< ", write back " << c.write_backs << ", pin wait " << c.pin_waits << ", pin spin " << c.pin_spins
+					<< ", prefetch " << c.prefetches << ", prefetch used " << c.prefetch_hits << ", prefetch wasted " << c.prefetch_wasted << "}";
+			}
+			os << " tasks " << s.tasks << " wait avg " << (s.tasks ? s.task_wait_ns / s.tasks : 0) << "ns max " << s.task_wait_max_ns << "ns fast " << s.fast_holds << " log flush " << s.log_flushes << " checkpoint " << s.checkpoints << " shadow commit " << s.shadow_commits << std::endl;
+		}
+
+		// periodic log from the first worker, disabled when KEEPER_STATS_LOG_INTERVAL is zero
+		void tick_stats() {
+			if (!KEEPER_STATS_LOG_INTERVAL) {
+				return;
+			}
+			auto now = std::chrono::steady_clock::now();
+			if (now - stats_logged_at >= std::chrono::milliseconds(KEEPER_STATS_LOG_INTERVAL)) {
+				stats_logged_at = now;
+				log_stats(std::cerr);
+			}
 		}
 
-		void thread_loop() {
+		void thread_loop(std::size_t id) {
+			if (id == 0) {
+				stats_logged_at = std::chrono::steady_clock::now();
+			}
+			std::uint32_t slot;
 			while (true) {
-				std::unique_lock<std::mutex> lock(start_flag_mutex);
-				if (start_flag == false) {
-					return;
+				if (id == 0) {
+					tick_stats();
+				}
+				if (pending.try_pop(slot)) {
+					execute(slot);
+					continue;
+				}
+				// foreground preempts background between two background items, stopping skips background
+				if (start_flag.load() && execute_background()) {
+					continue;
+				}
+				// check again after prepare so a request pushed in between is never slept through
+				auto key = pending_event.prepare();
+				if (pending.try_pop(slot)) {
+					pending_event.cancel();
+					execute(slot);
+				} else if (!start_flag.load()) {
+					pending_event.cancel();
+					return; // queue is drained
+				} else if (has_background()) {
+					pending_event.cancel();
 				} else {
-					lock.unlock();
+					pending_event.wait(key);
 				}
-				thread_execute();
 			}
 		}
 
-		std::thread event_loop;
+		// worker pool executing keeper tasks, a hit of one client never waits behind the miss of another
+		std::vector<std::thread> workers;
 
-		bool start() {
+		bool start(std::size_t worker_count = KEEPER_WORKER_COUNT) {
 			std::unique_lock<std::mutex> lock(start_flag_mutex);
 			if (start_flag == true) {
 				return false;
 			}
 			start_flag = true;
+			checkpointing = false; // a checkpoint cut by stop is simply dropped
 			// init cache
-			for (auto i = 0; i < KEEPER_CACHE_LEVEL; ++i) {
-				caches.emplace_back(KEEPER_CACHE_LEVEL_SIZES[i], *this);;
+			for (std::size_t i = 0; i != KEEPER_CACHE_LEVEL; ++i) {
+				caches.emplace_back(KEEPER_CACHE_LEVEL_SIZES[i], *this, KEEPER_CACHE_LEVEL_NODES[i]);
 			}
-			for (auto i = 0; i < KEEPER_CACHE_LEVEL; ++i) {
-				infos.emplace_back(std::make_shared<shared_info_pair>(*this, caches[i]));
+			// scan ring stays behind all levels, MRU replacement recycles the frame a scan just released
+			caches.emplace_back(KEEPER_SCAN_RING_SIZE, *this);
+			add_background([this]() { this->load_warmup(); });
+
+			for (std::size_t i = 0; i != std::max<std::size_t>(worker_count, 1); ++i) {
+				workers.emplace_back([this, i]() { this->thread_loop(i); });
 			}
-			
-			event_loop = std::thread([this]() { this->thread_loop(); });
 			return true;
 		}
 
 		void stop() {
 			std::unique_lock<std::mutex> lock(start_flag_mutex);
 			start_flag = false;
+			pending_event.notify_all();
+			for (auto &worker : workers) {
+				worker.join();
+			}
+			workers.clear();
+			// requests racing with stop are failed rather than left waiting forever
+			std::uint32_t slot;
+			while (pending.try_pop(slot)) {
+				requests[slot].error = std::make_exception_ptr(std::runtime_error("[keeper::stop] keeper is stopped"));
+				complete(slot);
+			}
 			lock.unlock();
-			event_loop.join();
 			save();
+			save_warmup();
+			background.clear();
+			prefetch_pending.clear();
+			has_prefetch = false;
 			// clear cache
-			infos.clear();
 			caches.clear();
 		}
 
-		void add_task(std::packaged_task<virtual_page()> &&task) {
-			std::unique_lock<std::mutex> lock(tasks_mutex);
-			tasks.push_back(std::move(task));
-			tasks_not_empty.notify_all();
+		// blocks only when every slot is in flight
+		std::uint32_t submit(request_enum kind, address addr, access_enum mode, const address *first = nullptr, const address *last = nullptr) {
+			std::uint32_t slot;
+			while (!free_slots.try_pop(slot)) {
+				auto key = free_event.prepare();
+				if (free_slots.try_pop(slot)) {
+					free_event.cancel();
+					break;
+				}
+				free_event.wait(key);
+			}
+			enqueue(slot, kind, addr, mode, first, last, nullptr);
+			return slot;
 		}
 
-		std::future<virtual_page> hold_async(address addr) {
-			std::packaged_task<virtual_page()> tmp([this, addr]() {
-				return std::move(this->hold_func(addr));
-			});
-			auto result = tmp.get_future();
-			add_task(std::move(tmp));
-			return std::move(result);
+		void enqueue(std::uint32_t slot, request_enum kind, address addr, access_enum mode, const address *first, const address *last, std::coroutine_handle<> continuation) {
+			auto &request = requests[slot];
+			request.kind = kind;
+			request.addr = addr;
+			request.mode = mode;
+			request.batch.assign(first, last);
+			request.continuation = continuation;
+			request.queued_at = std::chrono::steady_clock::now();
+			request.finished.reset(static_cast<bool>(continuation));
+			pending.push(slot);
+			pending_event.notify_one();
 		}
 
-		std::future<virtual_page> loosen_async(address addr) {
-			std::packaged_task<virtual_page()> tmp([this, addr]() {
-				return std::move(this->loosen_func(addr));
-			});
+		// coroutine waiters parked on slots, release_request hands its slot over and issues the request
+		std::deque<slot_waiter *> slot_waiters;
+		std::mutex slot_waiters_mutex;
+		std::atomic<std::size_t> slot_waiter_cnt = 0;
+
+		void issue(slot_waiter *waiter) {
+			if (!free_slots.try_pop(waiter->slot)) {
+				std::unique_lock<std::mutex> lock(slot_waiters_mutex);
+				slot_waiter_cnt.fetch_add(1);
+				if (!free_slots.try_pop(waiter->slot)) {
+					slot_waiters.push_back(waiter);
+					return;
+				}
+				slot_waiter_cnt.fetch_sub(1);
+			}
+			enqueue(waiter->slot, waiter->kind, waiter->addr, waiter->mode, waiter->first, waiter->last, waiter->continuation);
+		}
+
+		void release_request(std::uint32_t slot) {
+			auto &request = requests[slot];
+			request.result = virtual_page();
+			request.batch.clear();
+			request.results.clear();
+			request.error = nullptr;
+			request.continuation = nullptr;
+			free_slots.push(slot);
+			// push before checking waiters, a waiter counted after the push finds the slot itself
+			// the fence keeps the check from passing the release store of push
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (slot_waiter_cnt.load()) {
+				std::unique_lock<std::mutex> lock(slot_waiters_mutex);
+				while (!slot_waiters.empty() && free_slots.try_pop(slot)) {
+					auto waiter = slot_waiters.front();
+					slot_waiters.pop_front();
+					slot_waiter_cnt.fetch_sub(1);
+					waiter->slot = slot;
+					enqueue(slot, waiter->kind, waiter->addr, waiter->mode, waiter->first, waiter->last, waiter->continuation);
+				}
+			}
+			free_event.notify_one();
+		}
+
+		void add_background(std::function<void()> &&func) {
+			std::unique_lock<std::mutex> lock(background_mutex);
+			background.push_back(std::move(func));
+			lock.unlock();
+			pending_event.notify_one();
+		}
+
+		// hint for pages needed soon, workers load them only when no foreground request waits
+		// nothing is pinned and caller never blocks, a page evicted before its hold counts as wasted
+		void prefetch(const address *first, const address *last, access_enum mode = DEFAULT_ACCESS) {
+			std::unique_lock<std::mutex> lock(background_mutex);
+			for (; first != last; ++first) {
+				if (!prefetch_pending.insert(*first).second) {
+					continue;
+				}
+				background.push_back([this, addr = *first, mode]() {
+					this->prefetch_func(addr, mode);
+				});
+			}
+			has_prefetch.store(!prefetch_pending.empty(), std::memory_order_relaxed);
+			lock.unlock();
+			pending_event.notify_one();
+		}
+
+		void prefetch(const std::vector<address> &addrs, access_enum mode = DEFAULT_ACCESS) {
+			prefetch(addrs.data(), addrs.data() + addrs.size(), mode);
+		}
+
+		request_future hold_async(address addr, access_enum mode = DEFAULT_ACCESS) {
+			return request_future(this, submit(HOLD_REQUEST, addr, mode));
+		}
+
+		// one request for all pages, handles come back pinned and in the order of addresses
+		batch_future hold_many_async(const address *first, const address *last, access_enum mode = DEFAULT_ACCESS) {
+			return batch_future(this, submit(HOLD_MANY_REQUEST, 0, mode, first, last));
+		}
+
+		batch_future hold_many_async(const std::vector<address> &addrs, access_enum mode = DEFAULT_ACCESS) {
+			return hold_many_async(addrs.data(), addrs.data() + addrs.size(), mode);
+		}
+
+		request_awaiter<virtual_page> co_hold(address addr, access_enum mode = DEFAULT_ACCESS) {
+			return request_awaiter<virtual_page>(this, HOLD_REQUEST, addr, mode);
+		}
+
+		request_awaiter<std::vector<virtual_page>> co_hold_many(const address *first, const address *last, access_enum mode = DEFAULT_ACCESS) {
+			return request_awaiter<std::vector<virtual_page>>(this, HOLD_MANY_REQUEST, 0, mode, first, last);
+		}
+
+		request_awaiter<std::vector<virtual_page>> co_hold_many(const std::vector<address> &addrs, access_enum mode = DEFAULT_ACCESS) {
+			return co_hold_many(addrs.data(), addrs.data() + addrs.size(), mode);
+		}
+
+		request_future loosen_async(address addr) {
+			return request_future(this, submit(LOOSEN_REQUEST, addr, DEFAULT_ACCESS));
+		}
+
+		// resident page is pinned on the caller thread, ring promotion and misses go to workers
+		bool try_hold(address addr, access_enum mode, virtual_page &value) {
+			if (!start_flag.load()) {
+				return false;
+			}
+			std::size_t level;
+			try {
+				level = trans.find_cache_level(addr);
+			} catch (const std::runtime_error &) {
+				return false; // let the worker report it
+			}
+			auto pool = &caches[level];
+			page tmp;
+			if (!pool->try_get(addr, tmp)) {
+				pool = &caches[KEEPER_SCAN_RING];
+				if (mode != SCAN_ACCESS || !pool->try_get(addr, tmp)) {
+					return false;
+				}
+			}
+			virtual_page held(tmp, this, pool, addr, mode);
+			if (!held.pin()) {
+				return false; // frame is replaced in between
+			}
+			fast_cnt.fetch_add(1, std::memory_order_relaxed);
+			value = std::move(held);
+			return true;
+		}
+
+		virtual_page hold(address addr, access_enum mode = DEFAULT_ACCESS) {
+			virtual_page result;
+			if (try_hold(addr, mode, result)) {
+				return result;
+			}
+			return hold_async(addr, mode).get();
+		}
 
-			auto result = tmp.get_future();
-			add_task(std::move(tmp));
-			return std::move(result);
+		std::vector<virtual_page> hold_many(const address *first, const address *last, access_enum mode = DEFAULT_ACCESS) {
+			return hold_many_async(first, last, mode).get();
 		}
 
-		virtual_page hold(address addr) {
-			auto result = hold_async(addr);
-			result.wait();
-			return result.get();
+		std::vector<virtual_page> hold_many(const std::vector<address> &addrs, access_enum mode = DEFAULT_ACCESS) {
+			return hold_many_async(addrs, mode).get();
 		}
 
 		virtual_page loosen(address addr) {
-			auto result = loosen_async(addr);
-			result.wait();
-			return result.get();
+			return loosen_async(addr).get();
 		}
 		
 		std::string get_name() {
-			return trans.entry.get_database_name();
+			return trans.get_database_name();
 		}
 
 		void set_name(const std::string &name) {
-			trans.entry.set_database_name(name);
+			trans.set_database_name(name);
 		}
 
 	};
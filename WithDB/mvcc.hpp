@@ -0,0 +1,250 @@
+#ifndef __MVCC_HPP__
+#define __MVCC_HPP__
+
+// tuple versions for snapshot reads, writers change pages in place and keep before images here
+
+#include "type_config.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace db {
+	// before image of one tuple, a change inserting the tuple has nothing before
+	struct undo_record {
+		std::uint64_t ts; // commit timestamp of the change
+		std::uint64_t txn; // owner transaction, 0 for a change committed with its page
+		page_address index;
+		bool existed;
+		std::vector<char> before;
+	};
+
+	// commit timestamps come from one clock, a snapshot sees every change committed at or before its timestamp
+	// chains are per page with the newest record last, records every snapshot already sees are dropped
+	// one tuple is changed by one writer at a time, so the records of one index are in commit order
+	struct version_store {
+		constexpr static std::uint64_t UNCOMMITTED = std::numeric_limits<std::uint64_t>::max();
+
+		struct shard {
+			std::mutex latch;
+			std::unordered_map<address, std::vector<undo_record>> chains;
+		};
+
+		std::atomic<std::uint64_t> clock;
+		std::mutex snapshot_mutex;
+		std::multiset<std::uint64_t> active; // timestamps of running snapshots
+		shard shards[VERSION_STORE_SHARDS];
+
+	public:
+		version_store() : clock(0) {
+		}
+
+		version_store(const version_store &other) = delete;
+		version_store &operator=(const version_store &other) = delete;
+
+		std::uint64_t begin_snapshot() {
+			std::unique_lock<std::mutex> lock(snapshot_mutex);
+			auto ts = clock.load();
+			active.insert(ts);
+			return ts;
+		}
+
+		void end_snapshot(std::uint64_t ts) {
+			std::unique_lock<std::mutex> lock(snapshot_mutex);
+			auto iter = active.find(ts);
+			if (iter == active.end()) {
+				return;
+			}
+			auto oldest = iter == active.begin();
+			active.erase(iter);
+			lock.unlock();
+			if (oldest) {
+				collect();
+			}
+		}
+
+		// records older than any running or future snapshot
+		std::uint64_t horizon() {
+			std::unique_lock<std::mutex> lock(snapshot_mutex);
+			return active.empty() ? clock.load() : *active.begin();
+		}
+
+		// writer holds the page exclusively from its first record to commit, a transaction until its own commit
+		void record(address page, page_address index, bool existed, const char *first = nullptr, const char *last = nullptr, std::uint64_t txn = 0) {
+			auto &s = shard_of(page);
+			std::unique_lock<std::mutex> lock(s.latch);
+			s.chains[page].push_back(undo_record{ UNCOMMITTED, txn, index, existed, std::vector<char>(first, last) });
+		}
+
+		// stamp uncommitted records of the page with one timestamp, clock moves under the shard latch
+		// so a snapshot taking the new timestamp reads the chain only after the stamp
+		std::uint64_t commit(address page) {
+			auto limit = horizon();
+			auto &s = shard_of(page);
+			std::unique_lock<std::mutex> lock(s.latch);
+			auto iter = s.chains.find(page);
+			if (iter == s.chains.end()) {
+				return clock.load();
+			}
+			auto ts = clock.fetch_add(1) + 1;
+			for (auto &record : iter->second) {
+				if (record.ts == UNCOMMITTED && !record.txn) {
+					record.ts = ts;
+				}
+			}
+			prune(iter->second, limit);
+			if (iter->second.empty()) {
+				s.chains.erase(iter);
+			}
+			return ts;
+		}
+
+		// stamp records of a transaction on all its pages with one timestamp
+		// no snapshot starts in between, so a snapshot sees all of them or none
+		std::uint64_t commit(std::uint64_t txn, const std::vector<address> &pages) {
+			std::unique_lock<std::mutex> lock(snapshot_mutex);
+			auto ts = clock.fetch_add(1) + 1;
+			for (auto page : pages) {
+				auto &s = shard_of(page);
+				std::unique_lock<std::mutex> shard_lock(s.latch);
+				auto iter = s.chains.find(page);
+				if (iter == s.chains.end()) {
+					continue;
+				}
+				for (auto &record : iter->second) {
+					if (record.txn == txn) {
+						record.ts = ts;
+						record.txn = 0;
+					}
+				}
+			}
+			return ts;
+		}
+
+		// drop records of an aborted transaction, its changes are already undone in pages
+		void abort(std::uint64_t txn, const std::vector<address> &pages) {
+			for (auto page : pages) {
+				auto &s = shard_of(page);
+				std::unique_lock<std::mutex> lock(s.latch);
+				auto iter = s.chains.find(page);
+				if (iter == s.chains.end()) {
+					continue;
+				}
+				auto &chain = iter->second;
+				chain.erase(std::remove_if(chain.begin(), chain.end(), [txn](const undo_record &record) {
+					return record.txn == txn;
+				}), chain.end());
+				if (chain.empty()) {
+					s.chains.erase(iter);
+				}
+			}
+		}
+
+		// another transaction changed the tuple and has not committed yet
+		bool is_locked(address page, page_address index, std::uint64_t txn) {
+			auto &s = shard_of(page);
+			std::unique_lock<std::mutex> lock(s.latch);
+			auto iter = s.chains.find(page);
+			if (iter == s.chains.end()) {
+				return false;
+			}
+			return std::any_of(iter->second.begin(), iter->second.end(), [index, txn](const undo_record &record) {
+				return record.index == index && record.ts == UNCOMMITTED && record.txn && record.txn != txn;
+			});
+		}
+
+		// page has changes a snapshot does not see, its image has to be rolled back before use
+		bool is_changed(address page, std::uint64_t snapshot) {
+			auto &s = shard_of(page);
+			std::unique_lock<std::mutex> lock(s.latch);
+			auto iter = s.chains.find(page);
+			if (iter == s.chains.end()) {
+				return false;
+			}
+			return std::any_of(iter->second.begin(), iter->second.end(), [snapshot](const undo_record &record) {
+				return record.ts > snapshot;
+			});
+		}
+
+		// turn rows read from a page image back into rows visible at snapshot, newest change is undone first
+		void rollback(address page, std::uint64_t snapshot, std::map<page_address, std::vector<char>> &rows) {
+			auto &s = shard_of(page);
+			std::unique_lock<std::mutex> lock(s.latch);
+			auto iter = s.chains.find(page);
+			if (iter == s.chains.end()) {
+				return;
+			}
+			for (auto record = iter->second.rbegin(); record != iter->second.rend(); ++record) {
+				if (record->ts <= snapshot) {
+					continue;
+				}
+				if (record->existed) {
+					rows[record->index] = record->before;
+				} else {
+					rows.erase(record->index);
+				}
+			}
+		}
+
+		// drop records of every page behind the oldest snapshot
+		void collect() {
+			auto limit = horizon();
+			for (auto &s : shards) {
+				std::unique_lock<std::mutex> lock(s.latch);
+				for (auto iter = s.chains.begin(); iter != s.chains.end();) {
+					prune(iter->second, limit);
+					iter = iter->second.empty() ? s.chains.erase(iter) : std::next(iter);
+				}
+			}
+		}
+
+		std::size_t size() {
+			std::size_t ret = 0;
+			for (auto &s : shards) {
+				std::unique_lock<std::mutex> lock(s.latch);
+				for (auto &pair : s.chains) {
+					ret += pair.second.size();
+				}
+			}
+			return ret;
+		}
+
+	private:
+		inline shard &shard_of(address page) {
+			return shards[(page >> PAGE_BIT_LENGTH) % VERSION_STORE_SHARDS];
+		}
+
+		// a transaction commits later than records appended after its own, so visible records are anywhere in a chain
+		static void prune(std::vector<undo_record> &chain, std::uint64_t limit) {
+			chain.erase(std::remove_if(chain.begin(), chain.end(), [limit](const undo_record &record) {
+				return record.ts <= limit;
+			}), chain.end());
+		}
+	};
+
+	// running snapshot, records newer than it are kept until it ends
+	struct snapshot {
+		version_store *owner;
+		std::uint64_t ts;
+
+	public:
+		explicit snapshot(version_store &owner) : owner(&owner), ts(owner.begin_snapshot()) {
+		}
+
+		snapshot(const snapshot &other) = delete;
+		snapshot &operator=(const snapshot &other) = delete;
+
+		~snapshot() {
+			owner->end_snapshot(ts);
+		}
+	};
+}
+
+#endif // __MVCC_HPP__
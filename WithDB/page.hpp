@@ -4,6 +4,8 @@
 #include "endian_function.hpp"
 #include "type_config.hpp"
 
+#include <atomic>
+#include <cstdint>
 #include <iterator>
 #include <memory>
 #include <stdexcept>
@@ -21,94 +23,150 @@ namespace db {
 
 	}
 
-	template<typename Iter, std::size_t Size = PAGE_SIZE,
-		ns::page::enable_if_char_iterator_t<Iter> * = nullptr,
-		ns::page::enable_if_random_iterator_t<Iter> * = nullptr
-	>
-	struct basic_page {
-		using shared_type = std::shared_ptr<std::pair<Iter, Iter>>;
-		shared_type shared_pair;
+	// frame descriptor shared by all handles of one cache slot
+	// generation changes whenever the slot is reused, so stale handles become inactive without reference counting
+	struct frame {
+		constexpr static int REPLACE_PIN = -1; // frame is locked by cache for replacement
+
+		std::atomic<std::uint32_t> generation;
+		std::atomic<int> pin_cnt;
+		std::atomic<bool> dirty; // only dirty frames are written back
+		std::atomic<std::uint64_t> page_lsn; // last logged change, log is forced up to it before write back
+		std::atomic<std::uint64_t> rec_lsn; // first logged change since the page was clean, redo of the page starts there
 
 	public:
-		inline basic_page(const shared_type &shared_pair) : shared_pair(shared_pair) {
-			if (shared_pair && size() > static_cast<std::ptrdiff_t>(Size)) {
-				throw std::out_of_range("[basic_page::constructor] space too large for page operation");
-			}
+		frame() : generation(0), pin_cnt(0), dirty(false), page_lsn(0), rec_lsn(0) {
 		}
-		inline basic_page(shared_type &&shared_pair): shared_pair(shared_pair) {
-			if (shared_pair && size() > static_cast<std::ptrdiff_t>(Size)) {
-				throw std::out_of_range("[basic_page::constructor] space too large for page operation");
+
+		// exclusive pin of the frame for the page version of generation
+		inline bool pin(std::uint32_t gen) {
+			int expected = 0;
+			if (!pin_cnt.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+				return false;
+			}
+			if (generation.load(std::memory_order_acquire) != gen) {
+				pin_cnt.store(0, std::memory_order_release);
+				return false;
 			}
+			return true;
 		}
 
-		inline basic_page(Iter first, Iter last): basic_page(std::make_shared<std::pair<Iter, Iter>>(std::make_pair(first, last))) {
+		inline void unpin() {
+			pin_cnt.store(0, std::memory_order_release);
 		}
 
-		inline basic_page(const basic_page &other) : shared_pair(other.shared_pair) {
+		inline bool is_pinned() {
+			return pin_cnt.load(std::memory_order_acquire) > 0;
 		}
 
-		inline basic_page(basic_page &&other) : shared_pair(std::move(other.shared_pair)) {
+		inline bool lock() {
+			int expected = 0;
+			return pin_cnt.compare_exchange_strong(expected, REPLACE_PIN, std::memory_order_acquire);
 		}
 
-		inline basic_page() {
+		inline void unlock() {
+			pin_cnt.store(0, std::memory_order_release);
 		}
 
-		inline basic_page &operator=(const basic_page &other) {
-			shared_pair = other.shared_pair;
-			return *this;
+		inline void invalidate() {
+			generation.fetch_add(1, std::memory_order_acq_rel);
 		}
 
-		inline basic_page &operator=(basic_page &&other) {
-			shared_pair = std::move(other.shared_pair);
-			return *this;
+		inline void mark_dirty() {
+			dirty.store(true, std::memory_order_relaxed);
 		}
 
-		inline shared_type get_pair_ptr() {
-			return shared_pair;
+		// set before the record is appended, so a checkpoint never misses a logged change of a dirty page
+		inline void mark_logging(std::uint64_t lsn) {
+			if (!rec_lsn.load(std::memory_order_relaxed)) {
+				rec_lsn.store(lsn, std::memory_order_relaxed);
+			}
+			mark_dirty();
 		}
 
-		inline void set_pair_ptr(shared_type &&shared_pair)  {
-			if (shared_pair && size() > static_cast<std::ptrdiff_t>(Size)) {
-				throw std::out_of_range("[basic_page::constructor] space too large for page operation");
+		// writer holds the exclusive pin, so plain max is enough
+		inline void mark_logged(std::uint64_t lsn) {
+			if (lsn > page_lsn.load(std::memory_order_relaxed)) {
+				page_lsn.store(lsn, std::memory_order_relaxed);
 			}
-			this->shared_pair = std::move(shared_pair);
+			mark_dirty();
 		}
+	};
+
+	// page handle is {frame, generation} plus the fixed memory range of the frame, copying it never touches heap
+	// page without frame owns its range directly, e.g. entry pages of drive and translator
+	template<typename Iter, std::size_t Size = PAGE_SIZE,
+		ns::page::enable_if_char_iterator_t<Iter> * = nullptr,
+		ns::page::enable_if_random_iterator_t<Iter> * = nullptr
+	>
+	struct basic_page {
+		Iter first;
+		Iter last;
+		frame *desc;
+		std::uint32_t generation;
 
-		inline void set_pair_ptr(const shared_type &shared_pair) {
-			if (shared_pair && size() > static_cast<std::ptrdiff_t>(Size)) {
+	public:
+		inline basic_page(Iter first, Iter last, frame *desc = nullptr, std::uint32_t generation = 0) :
+			first(first), last(last), desc(desc), generation(generation) {
+			if (size() > Size) {
 				throw std::out_of_range("[basic_page::constructor] space too large for page operation");
 			}
-			this->shared_pair = shared_pair;
 		}
 
+		inline basic_page(const basic_page &other) = default;
+
+		inline basic_page(basic_page &&other) = default;
+
+		inline basic_page() : first(), last(), desc(nullptr), generation(0) {
+		}
+
+		inline basic_page &operator=(const basic_page &other) = default;
+
+		inline basic_page &operator=(basic_page &&other) = default;
+
 		inline void set_pair_ptr(Iter first, Iter last) {
-			set_pair_ptr(std::make_shared<std::pair<Iter, Iter>>(std::make_pair(first, last)));
+			if (static_cast<std::size_t>(last - first) > Size) {
+				throw std::out_of_range("[basic_page::set_pair_ptr] space too large for page operation");
+			}
+			this->first = first;
+			this->last = last;
+			desc = nullptr;
+			generation = 0;
+		}
+
+		inline frame *get_frame() {
+			return desc;
 		}
 
 		inline bool is_active() {
-			return shared_pair && size() != 0;
+			return first != last && (!desc || desc->generation.load(std::memory_order_acquire) == generation);
 		}
 
+		// deactivate every handle of the same frame
 		inline void deactivate() {
-			shared_pair->second = shared_pair->first;
+			if (desc) {
+				desc->invalidate();
+			} else {
+				last = first;
+			}
 		}
 
 		inline Iter begin() {
-			return shared_pair->first;
+			return first;
 		}
 
 		inline Iter end() {
-			return shared_pair->second;
+			return last;
 		}
 
 		inline std::size_t size() {
-			return shared_pair ? end() - begin() : 0;
+			return static_cast<std::size_t>(last - first);
 		}
 
 		template<typename Type>
 		inline Type read(page_address first, page_address last) {
 			auto b = begin(), e = end();
-			if (b == e || last > e - b || first >= last) {
+			if (!is_active() || last > e - b || first >= last) {
 				throw std::out_of_range("[basic_page::read] address fetch error or out of page range");
 			}
 			return read_value<Type>(b + first, b + last);
@@ -117,7 +175,7 @@ namespace db {
 		template<typename Type>
 		inline Type read(page_address first) {
 			auto b = begin(), e = end();
-			if (b == e || first >= e - b) {
+			if (!is_active() || first >= e - b) {
 				throw std::out_of_range("[basic_page::read] address fetch error or out of page range");
 			}
 			return read_value<Type>(b + first, e);
@@ -126,22 +184,31 @@ namespace db {
 		template<typename Type>
 		inline void write(Type value, page_address first, page_address last) {
 			auto b = begin(), e = end();
-			if (b == e || last > e - b || first >= last) {
+			if (!is_active() || last > e - b || first >= last) {
 				throw std::out_of_range("[basic_page::write] address fetch error or out of page range");
 			}
+			if (desc) {
+				desc->mark_dirty();
+			}
 			write_value(value, b + first, b + last);
 		}
 
 		template<typename Type>
 		inline void write(Type value, page_address first) {
 			auto b = begin(), e = end();
-			if (b == e || first >= e - b) {
+			if (!is_active() || first >= e - b) {
 				throw std::out_of_range("[basic_page::write] address fetch error or out of page range");
 			}
+			if (desc) {
+				desc->mark_dirty();
+			}
 			write_value(value, b + first, e);
 		}
 
 		void clear() {
+			if (desc) {
+				desc->mark_dirty();
+			}
 			for (auto iter = begin(); iter != end(); ++iter) {
 				*iter = 0;
 			}
@@ -156,7 +223,8 @@ namespace db {
 		using iterator = Iter;
 	};
 
-	using page = basic_page<std::vector<char>::iterator>;
+	// raw pointer page so that frames can live in any arena, not only in vector
+	using page = basic_page<char *>;
 }
 
 #endif // __PAGE_HPP__
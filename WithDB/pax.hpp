@@ -0,0 +1,382 @@
+#ifndef __PAX_HPP__
+#define __PAX_HPP__
+
+// pax data page, tuples of a page are split by attribute and every attribute keeps its values together in a minipage
+// a scan reading a few attributes touches only their minipages, varchar bytes go to a heap growing down from page end
+
+#include "keeper.hpp"
+#include "tuple.hpp"
+#include "type_config.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace db {
+	// value of slot i is [begin + i * size, begin + (i + 1) * size), varchar value is first and last of its heap bytes
+	struct minipage_entry {
+		attribute_type_enum type;
+		page_address size;
+		page_address begin;
+	};
+
+	// page must be clean or in pax format: load throws out_of_range on a clean page and runtime_error on any other format,
+	// pages of unknown format go through visit_page
+	struct pax_page : virtual_page {
+		constexpr static page_address FLAGS_POS = 0;
+		constexpr static page_address COUNT_POS = 2;
+		constexpr static page_address CAPACITY_POS = 4;
+		constexpr static page_address HEAP_PTR_POS = 6;
+		constexpr static page_address COLUMN_COUNT_POS = 8;
+		constexpr static page_address HEADER_SIZE = 10;
+
+		constexpr static page_address MINIPAGE_ENTRY_SIZE = 6;
+		constexpr static page_address MINIPAGE_ENTRY_TYPE_POS = 0;
+		constexpr static page_address MINIPAGE_ENTRY_SIZE_POS = 2;
+		constexpr static page_address MINIPAGE_ENTRY_BEGIN_POS = 4;
+		constexpr static page_address MINIPAGE_ALIGNMENT = 8;
+
+		page_address flags;
+		page_address count; // slots handed out, a freed slot is not reused
+		page_address capacity;
+		page_address heap_ptr;
+		std::vector<minipage_entry> columns;
+		std::vector<std::uint8_t> live; // bit per slot, cleared by free
+		bool modified = false; // dump of an unmodified page writes nothing
+		bool latched = false; // writer keeps the page pinned from load to dump
+		std::uint64_t txn = 0; // transaction changing the page, 0 commits with dump
+	public:
+		pax_page(virtual_page &&origin) : virtual_page(std::move(origin)) {
+		}
+
+		virtual void load() {
+			reactivate();
+			pin_wait();
+			modified = false;
+			flags = read<page_address>(FLAGS_POS);
+			if (flags != PAX_PAGE) {
+				unpin();
+				if (!flags) {
+					throw std::out_of_range("clean page");
+				}
+				throw std::runtime_error("[pax_page::load] page is not in pax format");
+			}
+			count = read<page_address>(COUNT_POS);
+			capacity = read<page_address>(CAPACITY_POS);
+			heap_ptr = read<page_address>(HEAP_PTR_POS);
+			columns.resize(read<page_address>(COLUMN_COUNT_POS));
+			page_address i = HEADER_SIZE;
+			for (auto &c : columns) {
+				c.type = static_cast<attribute_type_enum>(read<page_address>(i + MINIPAGE_ENTRY_TYPE_POS));
+				c.size = read<page_address>(i + MINIPAGE_ENTRY_SIZE_POS);
+				c.begin = read<page_address>(i + MINIPAGE_ENTRY_BEGIN_POS);
+				i += MINIPAGE_ENTRY_SIZE;
+			}
+			live.resize(bitmap_size());
+			std::copy(begin() + i, begin() + i + live.size(), live.begin());
+			unpin();
+		}
+
+		virtual void dump() {
+			if (!modified) {
+				return;
+			}
+			reactivate();
+			pin_wait();
+			write(flags, FLAGS_POS);
+			write(count, COUNT_POS);
+			write(capacity, CAPACITY_POS);
+			write(heap_ptr, HEAP_PTR_POS);
+			write(static_cast<page_address>(columns.size()), COLUMN_COUNT_POS);
+			page_address i = HEADER_SIZE;
+			for (auto &c : columns) {
+				write(static_cast<page_address>(c.type), i + MINIPAGE_ENTRY_TYPE_POS);
+				write(c.size, i + MINIPAGE_ENTRY_SIZE_POS);
+				write(c.begin, i + MINIPAGE_ENTRY_BEGIN_POS);
+				i += MINIPAGE_ENTRY_SIZE;
+			}
+			for (auto bits : live) {
+				write(bits, i++);
+			}
+			log_range(FLAGS_POS, i);
+			if (owner) {
+				owner->versions.commit(addr); // header is written, new versions become visible together
+			}
+			modified = false;
+			unpin();
+		}
+
+		// minipages are sized for tuples of table, each varchar value is expected to take reserve heap bytes
+		void init(const tuple_table &table, std::size_t reserve = PAX_VARCHAR_RESERVE) {
+			std::size_t row = 0, vars = 0;
+			columns.clear();
+			for (auto &entry : table) {
+				columns.push_back(minipage_entry{ entry.get_type(), entry.get_size(), 0 });
+				row += entry.get_size();
+				vars += entry.get_type() == VARCHAR_T;
+			}
+			std::size_t meta = HEADER_SIZE + columns.size() * MINIPAGE_ENTRY_SIZE;
+			if (!row || meta + MINIPAGE_ALIGNMENT >= PAGE_SIZE) {
+				throw std::out_of_range("[pax_page::init] tuple does not fit a pax page");
+			}
+			// a slot costs its values, its heap reserve and one live bit, alignment after the bitmap costs the rest
+			auto cap = (PAGE_SIZE - meta - MINIPAGE_ALIGNMENT) * 8 / ((row + vars * reserve) * 8 + 1);
+			if (!cap) {
+				throw std::out_of_range("[pax_page::init] tuple does not fit a pax page");
+			}
+			modified = true;
+			flags = PAX_PAGE;
+			count = 0;
+			capacity = static_cast<page_address>(std::min<std::size_t>(cap, PAGE_SIZE));
+			heap_ptr = static_cast<page_address>(PAGE_SIZE);
+			live.assign(bitmap_size(), 0);
+			auto pos = meta + live.size();
+			pos = (pos + MINIPAGE_ALIGNMENT - 1) / MINIPAGE_ALIGNMENT * MINIPAGE_ALIGNMENT;
+			for (auto &c : columns) {
+				c.begin = static_cast<page_address>(pos);
+				pos += static_cast<std::size_t>(capacity) * c.size;
+			}
+		}
+
+		void close() {
+			dump();
+		}
+
+		// pin across load, changes and dump, so a reader copying the page never sees a half written header
+		void latch() {
+			reactivate();
+			pin_wait();
+			latched = true;
+		}
+
+		void unlatch() {
+			if (latched) {
+				latched = false;
+				unpin();
+			}
+		}
+
+		void unpin() {
+			if (!latched) {
+				virtual_page::unpin();
+			}
+		}
+
+		inline bool is_live(page_address index) {
+			return index < count && (live[index / 8] >> (index % 8) & 1);
+		}
+
+		// first byte of minipage of column, values of slots [0, count) follow
+		inline page_address minipage(std::size_t column) {
+			return columns[column].begin;
+		}
+
+		template<typename Type>
+		inline Type value(std::size_t column, page_address index) {
+			return read<Type>(static_cast<page_address>(columns[column].begin + index * columns[column].size));
+		}
+
+		// [first, last) of heap bytes of a varchar value
+		inline std::pair<page_address, page_address> heap_range(std::size_t column, page_address index) {
+			auto pos = static_cast<page_address>(columns[column].begin + index * columns[column].size);
+			return std::make_pair(read<page_address>(pos), read<page_address>(static_cast<page_address>(pos + sizeof(page_address))));
+		}
+
+		// average heap bytes of a varchar value on this page, a new page of the same table is sized by it
+		std::size_t heap_reserve() {
+			auto vars = static_cast<std::size_t>(std::count_if(columns.begin(), columns.end(), [](const minipage_entry &c) {
+				return c.type == VARCHAR_T;
+			}));
+			if (!count || !vars) {
+				return PAX_VARCHAR_RESERVE;
+			}
+			return (PAGE_SIZE - heap_ptr + count * vars - 1) / (count * vars);
+		}
+
+		// return index, t is built by tuple_builder for the table the page was initialized with
+		// out_of_range on a full page, as tuple_page does, insert moves on to the next page
+		page_address allocate(const tuple &t) {
+			if (count == capacity || t.size() < fix_size()) {
+				throw std::out_of_range("no enough space");
+			}
+			if (heap_ptr - heap_floor() < heap_size(t)) {
+				throw std::out_of_range("no enough space");
+			}
+			auto index = count;
+			if (owner) {
+				owner->versions.record(addr, index, false, nullptr, nullptr, txn);
+			}
+			modified = true;
+			++count;
+			set_live(index, true);
+			return index;
+		}
+
+		// scatter t over minipages of the allocated slot
+		void copy_from(const tuple &t, page_address index) {
+			reactivate();
+			pin_wait();
+			mark_dirty();
+			std::size_t offset = 0;
+			for (auto &c : columns) {
+				auto pos = static_cast<page_address>(c.begin + index * c.size);
+				if (c.type == VARCHAR_T) {
+					auto first = read_value<page_address>(t.begin() + offset, t.end());
+					auto last = read_value<page_address>(t.begin() + offset + sizeof(page_address), t.end());
+					auto old = heap_ptr;
+					heap_ptr -= last - first;
+					std::copy(t.begin() + first, t.begin() + last, begin() + heap_ptr);
+					log_range(heap_ptr, old);
+					write(heap_ptr, pos);
+					write(old, static_cast<page_address>(pos + sizeof(page_address)));
+				} else {
+					std::copy(t.begin() + offset, t.begin() + offset + c.size, begin() + pos);
+				}
+				log_range(pos, static_cast<page_address>(pos + c.size));
+				offset += c.size;
+			}
+			unpin();
+		}
+
+		// tuple of slot in tuple_builder layout
+		tuple gather(page_address index) {
+			std::size_t fixed = fix_size();
+			tuple t(fixed);
+			reactivate();
+			pin_wait();
+			std::size_t offset = 0;
+			for (auto &c : columns) {
+				auto pos = begin() + c.begin + index * c.size;
+				if (c.type == VARCHAR_T) {
+					auto first = read_value<page_address>(pos, end());
+					auto last = read_value<page_address>(pos + sizeof(page_address), end());
+					auto tail = static_cast<page_address>(t.size());
+					write_value(tail, t.begin() + offset, t.end());
+					write_value(static_cast<page_address>(tail + last - first), t.begin() + offset + sizeof(page_address), t.end());
+					t.insert(t.end(), begin() + first, begin() + last);
+				} else {
+					std::copy(pos, pos + c.size, t.begin() + offset);
+				}
+				offset += c.size;
+			}
+			unpin();
+			return t;
+		}
+
+		void free(page_address index) {
+			if (is_live(index)) {
+				if (owner) {
+					auto before = gather(index);
+					owner->versions.record(addr, index, true, before.data(), before.data() + before.size(), txn);
+				}
+				modified = true;
+				set_live(index, false);
+			}
+		}
+
+		// undo free of an aborted transaction, values of a freed slot stay in place
+		void restore(page_address index) {
+			if (index < count && !is_live(index)) {
+				modified = true;
+				set_live(index, true);
+			}
+		}
+
+		// tuples visible at snapshot, page is pinned only while its image is copied
+		std::map<page_address, std::vector<char>> read_snapshot(std::uint64_t snapshot) {
+			std::vector<char> image(PAGE_SIZE);
+			reactivate();
+			pin_wait();
+			std::copy(begin(), end(), image.begin());
+			unpin();
+			pax_page copy(virtual_page(page(image.data(), image.data() + PAGE_SIZE), nullptr, nullptr, addr, mode));
+			copy.load();
+			std::map<page_address, std::vector<char>> rows;
+			for (page_address i = 0; i != copy.count; ++i) {
+				if (copy.is_live(i)) {
+					rows[i] = copy.gather(i);
+				}
+			}
+			if (owner) {
+				owner->versions.rollback(addr, snapshot, rows);
+			}
+			return rows;
+		}
+
+		~pax_page() {
+			close();
+			unlatch();
+		}
+
+	private:
+		inline std::size_t bitmap_size() {
+			return (static_cast<std::size_t>(capacity) + 7) / 8;
+		}
+
+		inline std::size_t fix_size() {
+			std::size_t ret = 0;
+			for (auto &c : columns) {
+				ret += c.size;
+			}
+			return ret;
+		}
+
+		// varchar heap may grow down to the end of the last minipage
+		inline std::size_t heap_floor() {
+			return columns.empty() ? PAGE_SIZE : columns.back().begin + static_cast<std::size_t>(capacity) * columns.back().size;
+		}
+
+		std::size_t heap_size(const tuple &t) {
+			std::size_t ret = 0, offset = 0;
+			for (auto &c : columns) {
+				if (c.type == VARCHAR_T) {
+					auto first = read_value<page_address>(t.begin() + offset, t.end());
+					auto last = read_value<page_address>(t.begin() + offset + sizeof(page_address), t.end());
+					if (first > last || last > t.size()) {
+						throw std::runtime_error("[pax_page::heap_size] broken varchar value");
+					}
+					ret += last - first;
+				}
+				offset += c.size;
+			}
+			return ret;
+		}
+
+		inline void set_live(page_address index, bool on) {
+			auto &bits = live[index / 8];
+			bits = static_cast<std::uint8_t>(on ? bits | 1 << (index % 8) : bits & ~(1 << (index % 8)));
+		}
+
+		// bytes copied straight into the frame still have to reach drive in shadow mode, which skips the log
+		inline void mark_dirty() {
+			if (desc) {
+				desc->mark_dirty();
+			}
+		}
+	};
+
+	// format of a held page, it is pinned only while its flags are read
+	inline page_format_enum page_format(virtual_page &p) {
+		p.reactivate();
+		p.pin_wait();
+		auto flags = p.read<page_address>(pax_page::FLAGS_POS);
+		p.unpin();
+		return flags == PAX_PAGE ? PAX_PAGE : flags ? ROW_PAGE : CLEAN_PAGE;
+	}
+
+	// call f with held page opened in its own format, clean page opens as a tuple_page
+	template<typename Func>
+	auto visit_page(virtual_page &&held, Func f) {
+		if (page_format(held) == PAX_PAGE) {
+			pax_page p(std::move(held));
+			return f(p);
+		}
+		tuple_page p(std::move(held));
+		return f(p);
+	}
+}
+
+#endif // __PAX_HPP__
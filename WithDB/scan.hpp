@@ -0,0 +1,278 @@
+#ifndef __SCAN_HPP__
+#define __SCAN_HPP__
+
+// vectorized scan, rows of a table come in batches of typed attribute arrays decoded straight from page images
+// type of an attribute is switched on once per page instead of once per row, strings are views into the images
+
+#include "keeper.hpp"
+#include "mvcc.hpp"
+#include "pax.hpp"
+#include "tuple.hpp"
+#include "type_config.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace db {
+	// values of one attribute for the rows of a batch, only the array of its type is filled
+	struct column_vector {
+		std::size_t column;
+		attribute_type_enum type;
+		std::vector<int_type> ints;
+		std::vector<long_type> longs;
+		std::vector<float_type> floats;
+		std::vector<double_type> doubles;
+		std::vector<std::string_view> strings; // char, date and varchar
+
+		void clear() {
+			ints.clear();
+			longs.clear();
+			floats.clear();
+			doubles.clear();
+			strings.clear();
+		}
+	};
+
+	// row i of the batch is element i of every column, views stay valid until the batch is filled again
+	struct scan_batch {
+		std::size_t size = 0;
+		std::vector<address> addrs;
+		std::vector<column_vector> columns;
+		std::vector<std::shared_ptr<std::vector<char>>> images; // page images and rolled back tuples the views point into
+	};
+
+	// rows as of the start of the scan, pages are pinned only while their images are copied
+	struct batch_scan {
+		// visible row of a page, tuple bytes are [first, last) of memory, pax row is its slot
+		struct scan_row {
+			page_address index;
+			std::size_t first;
+			std::size_t last;
+		};
+
+		// rows of the page being emitted
+		struct page_rows {
+			address addr = 0;
+			std::shared_ptr<std::vector<char>> memory;
+			bool pax = false;
+			std::vector<minipage_entry> minipages;
+			std::vector<scan_row> rows;
+			std::size_t next = 0;
+		};
+
+		keeper *owner;
+		std::shared_ptr<tuple_table> table;
+		std::vector<std::size_t> columns;
+		snapshot s;
+		address addr;
+		address last; // extent of the table when the snapshot began, a clean page before it is skipped
+		std::deque<std::pair<address, std::shared_ptr<std::vector<char>>>> ahead; // images copied but not decoded yet
+		page_rows current;
+
+	public:
+		// columns index table, rows are read from start to the last page of its segment ever written
+		// extent is taken after the snapshot, so every page holding a row the snapshot sees is before it
+		batch_scan(keeper &owner, std::shared_ptr<tuple_table> table, std::vector<std::size_t> columns, address start) :
+			owner(&owner), table(table), columns(std::move(columns)), s(owner.versions), addr(start), last(owner.segment_extent(start)) {
+			for (auto column : this->columns) {
+				if (column >= table->size()) {
+					throw std::out_of_range("[batch_scan::constructor] column out of table");
+				}
+			}
+		}
+
+		batch_scan(const batch_scan &other) = delete;
+		batch_scan &operator=(const batch_scan &other) = delete;
+
+		// up to SCAN_BATCH_ROWS rows, false once the scan is over and batch is empty
+		bool next(scan_batch &batch) {
+			batch.size = 0;
+			batch.addrs.clear();
+			batch.images.clear();
+			batch.columns.resize(columns.size());
+			for (std::size_t i = 0; i != columns.size(); ++i) {
+				batch.columns[i].column = columns[i];
+				batch.columns[i].type = (*table)[columns[i]].get_type();
+				batch.columns[i].clear();
+			}
+			while (batch.size != SCAN_BATCH_ROWS) {
+				if (current.next == current.rows.size()) {
+					if (!advance()) {
+						break;
+					}
+					continue;
+				}
+				emit(batch, std::min(SCAN_BATCH_ROWS - batch.size, current.rows.size() - current.next));
+			}
+			return batch.size != 0;
+		}
+
+	private:
+		bool advance() {
+			while (ahead.empty()) {
+				if (addr >= last) {
+					return false;
+				}
+				fetch();
+			}
+			auto front = std::move(ahead.front());
+			ahead.pop_front();
+			decode(front.first, front.second);
+			return true;
+		}
+
+		// copy a group of pages at once, the scan ring keeps them out of the working set of point lookups
+		void fetch() {
+			std::vector<address> batch;
+			for (std::size_t i = 0; i != KEEPER_SCAN_BATCH && addr < last; ++i, addr += PAGE_SIZE) {
+				batch.push_back(addr);
+			}
+			auto pages = owner->hold_many(batch, SCAN_ACCESS);
+			for (std::size_t i = 0; i != pages.size(); ++i) {
+				auto &p = pages[i];
+				auto image = std::make_shared<std::vector<char>>(PAGE_SIZE);
+				p.reactivate();
+				p.pin_wait();
+				std::copy(p.begin(), p.end(), image->begin());
+				p.unpin();
+				if (!read_value<page_address>(image->begin(), image->end())) {
+					continue; // clean page holds no row, a table may go on after it
+				}
+				ahead.emplace_back(batch[i], std::move(image));
+			}
+		}
+
+		// a page changed after the snapshot falls back to rolled back tuples laid end to end
+		void decode(address page_addr, std::shared_ptr<std::vector<char>> &image) {
+			current = page_rows();
+			current.addr = page_addr;
+			auto format = read_value<page_address>(image->begin(), image->end());
+			// asked at decode, up to KEEPER_SCAN_BATCH pages after the image was copied by fetch
+			// a change in the image has its record before its bytes, and records newer than the snapshot stay while it runs,
+			// so is_changed only errs towards a change made after the copy, whose rollback is idempotent on an image
+			// that never had it: an undone insert drops a missing row and an undone erase puts back the row already there
+			if (owner->versions.is_changed(page_addr, s.ts)) {
+				std::map<page_address, std::vector<char>> rows;
+				if (format == PAX_PAGE) {
+					rows = image_page<pax_page>(page_addr, *image).read_snapshot(s.ts);
+				} else {
+					rows = image_page<tuple_page>(page_addr, *image).read_snapshot(s.ts);
+				}
+				owner->versions.rollback(page_addr, s.ts, rows);
+				current.memory = std::make_shared<std::vector<char>>();
+				for (auto &pair : rows) {
+					auto first = current.memory->size();
+					current.memory->insert(current.memory->end(), pair.second.begin(), pair.second.end());
+					current.rows.push_back(scan_row{ pair.first, first, current.memory->size() });
+				}
+				return;
+			}
+			current.memory = image;
+			if (format == PAX_PAGE) {
+				auto p = image_page<pax_page>(page_addr, *image);
+				p.load();
+				current.pax = true;
+				current.minipages = p.columns;
+				for (page_address i = 0; i != p.count; ++i) {
+					if (p.is_live(i)) {
+						current.rows.push_back(scan_row{ i, 0, 0 });
+					}
+				}
+			} else {
+				auto p = image_page<tuple_page>(page_addr, *image);
+				p.load();
+				for (auto &entry : p.piece_table) {
+					if (!entry.is_free) {
+						current.rows.push_back(scan_row{ entry.index, entry.begin, entry.end });
+					}
+				}
+			}
+		}
+
+		// private page over an image, no frame and no owner, so it never logs or records versions
+		template<typename Page>
+		Page image_page(address page_addr, std::vector<char> &image) {
+			return Page(virtual_page(page(image.data(), image.data() + PAGE_SIZE), nullptr, nullptr, page_addr, SCAN_ACCESS));
+		}
+
+		void emit(scan_batch &batch, std::size_t n) {
+			auto first = current.rows.begin() + current.next, end = first + n;
+			if (batch.images.empty() || batch.images.back() != current.memory) {
+				batch.images.push_back(current.memory);
+			}
+			for (auto iter = first; iter != end; ++iter) {
+				batch.addrs.push_back(current.addr + iter->index);
+			}
+			for (auto &out : batch.columns) {
+				switch (out.type) {
+				case db::INT_T:
+					fill(out.ints, out.column, first, end);
+					break;
+				case db::LONG_T:
+					fill(out.longs, out.column, first, end);
+					break;
+				case db::FLOAT_T:
+					fill(out.floats, out.column, first, end);
+					break;
+				case db::DOUBLE_T:
+					fill(out.doubles, out.column, first, end);
+					break;
+				case db::CHAR_T:
+				case db::DATE_T:
+				case db::VARCHAR_T:
+					fill_strings(out.strings, out.column, out.type == VARCHAR_T, first, end);
+					break;
+				case db::BLOB_T:
+				default:
+					throw std::runtime_error("[batch_scan::emit] unknown type");
+				}
+			}
+			current.next += n;
+			batch.size += n;
+		}
+
+		// position of the value of column in row, relative to memory of the page
+		inline std::size_t value_pos(std::size_t column, const scan_row &row) {
+			if (current.pax) {
+				auto &c = current.minipages[column];
+				return c.begin + static_cast<std::size_t>(row.index) * c.size;
+			}
+			return row.first + (*table)[column].get_offset();
+		}
+
+		template<typename Type, typename Iter>
+		void fill(std::vector<Type> &out, std::size_t column, Iter first, Iter last) {
+			auto base = current.memory->data();
+			for (auto iter = first; iter != last; ++iter) {
+				auto pos = base + value_pos(column, *iter);
+				out.push_back(read_value<Type>(pos, pos + sizeof(Type)));
+			}
+		}
+
+		// varchar value holds first and last of its bytes, relative to the tuple or to the pax page
+		template<typename Iter>
+		void fill_strings(std::vector<std::string_view> &out, std::size_t column, bool var, Iter first, Iter last) {
+			auto base = current.memory->data();
+			auto size = (*table)[column].get_size();
+			for (auto iter = first; iter != last; ++iter) {
+				auto pos = base + value_pos(column, *iter);
+				if (var) {
+					auto origin = current.pax ? base : base + iter->first;
+					auto b = read_value<page_address>(pos, pos + sizeof(page_address));
+					auto e = read_value<page_address>(pos + sizeof(page_address), pos + sizeof(page_address) * 2);
+					out.emplace_back(origin + b, e - b);
+				} else {
+					out.emplace_back(pos, std::find(pos, pos + size, '\0') - pos);
+				}
+			}
+		}
+	};
+}
+
+#endif // __SCAN_HPP__
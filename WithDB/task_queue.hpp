@@ -0,0 +1,216 @@
+#ifndef __TASK_QUEUE_HPP__
+#define __TASK_QUEUE_HPP__
+
+// bounded lock-free queue and futex based wakeups for keeper requests
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Synchronization.lib")
+#endif
+#else
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace db {
+	namespace ns::task_queue {
+		constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+		// sleep while word equals expected, spurious return is allowed
+		inline void futex_wait(std::atomic<std::uint32_t> &word, std::uint32_t expected) {
+#ifdef _WIN32
+			WaitOnAddress(&word, &expected, sizeof(expected), INFINITE);
+#else
+			syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#endif
+		}
+
+		inline void futex_wake(std::atomic<std::uint32_t> &word, bool all) {
+#ifdef _WIN32
+			if (all) {
+				WakeByAddressAll(&word);
+			} else {
+				WakeByAddressSingle(&word);
+			}
+#else
+			syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE_PRIVATE, all ? INT32_MAX : 1, nullptr, nullptr, 0);
+#endif
+		}
+	}
+
+	// bounded multi-producer multi-consumer ring, every cell carries a sequence number (d. vyukov)
+	// capacity has to be a power of two
+	template <typename T>
+	struct mpmc_ring {
+		struct cell {
+			std::atomic<std::size_t> sequence;
+			T value;
+		};
+
+		std::unique_ptr<cell[]> cells;
+		std::size_t mask;
+		alignas(ns::task_queue::CACHE_LINE_SIZE) std::atomic<std::size_t> enqueue_pos;
+		alignas(ns::task_queue::CACHE_LINE_SIZE) std::atomic<std::size_t> dequeue_pos;
+
+	public:
+		explicit mpmc_ring(std::size_t capacity) : cells(new cell[capacity]), mask(capacity - 1), enqueue_pos(0), dequeue_pos(0) {
+			if (capacity < 2 || (capacity & (capacity - 1))) {
+				throw std::invalid_argument("[mpmc_ring::mpmc_ring] capacity must be a power of two");
+			}
+			for (std::size_t i = 0; i != capacity; ++i) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		mpmc_ring(const mpmc_ring &other) = delete;
+		mpmc_ring &operator=(const mpmc_ring &other) = delete;
+
+		bool try_push(const T &value) {
+			auto pos = enqueue_pos.load(std::memory_order_relaxed);
+			while (true) {
+				auto &target = cells[pos & mask];
+				auto seq = target.sequence.load(std::memory_order_acquire);
+				auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+				if (diff == 0) {
+					if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						target.value = value;
+						target.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false; // full
+				} else {
+					pos = enqueue_pos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		// for a ring sized to hold every item, full only means a consumer is still releasing its cell
+		void push(const T &value) {
+			while (!try_push(value)) {
+				std::this_thread::yield();
+			}
+		}
+
+		bool try_pop(T &value) {
+			auto pos = dequeue_pos.load(std::memory_order_relaxed);
+			while (true) {
+				auto &target = cells[pos & mask];
+				auto seq = target.sequence.load(std::memory_order_acquire);
+				auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+				if (diff == 0) {
+					if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						value = target.value;
+						target.sequence.store(pos + mask + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					return false; // empty
+				} else {
+					pos = dequeue_pos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		inline std::size_t capacity() const {
+			return mask + 1;
+		}
+	};
+
+	// sleep until something changed since prepare, notify only enters the kernel when someone sleeps
+	// usage: key = prepare(); check condition again; cancel() if it holds, wait(key) otherwise
+	struct event_count {
+		std::atomic<std::uint32_t> epoch;
+		std::atomic<std::uint32_t> waiters;
+
+	public:
+		event_count() : epoch(0), waiters(0) {
+		}
+
+		inline std::uint32_t prepare() {
+			waiters.fetch_add(1);
+			return epoch.load();
+		}
+
+		inline void cancel() {
+			waiters.fetch_sub(1);
+		}
+
+		void wait(std::uint32_t key) {
+			while (epoch.load() == key) {
+				ns::task_queue::futex_wait(epoch, key);
+			}
+			waiters.fetch_sub(1);
+		}
+
+		inline void notify_one() {
+			epoch.fetch_add(1);
+			if (waiters.load()) {
+				ns::task_queue::futex_wake(epoch, false);
+			}
+		}
+
+		inline void notify_all() {
+			epoch.fetch_add(1);
+			if (waiters.load()) {
+				ns::task_queue::futex_wake(epoch, true);
+			}
+		}
+	};
+
+	// one-shot completion flag of a single waiter, done() skips the wake when nobody sleeps
+	// a suspended coroutine is not woken here, done() tells the completer to resume it instead
+	struct completion {
+		constexpr static std::uint32_t PENDING = 0;
+		constexpr static std::uint32_t WAITING = 1;
+		constexpr static std::uint32_t DONE = 2;
+		constexpr static std::uint32_t SUSPENDED = 3;
+
+		std::atomic<std::uint32_t> state;
+
+	public:
+		completion() : state(PENDING) {
+		}
+
+		// suspended: completer resumes a coroutine instead of waking a thread
+		inline void reset(bool suspended = false) {
+			state.store(suspended ? SUSPENDED : PENDING, std::memory_order_relaxed);
+		}
+
+		inline bool is_done() const {
+			return state.load(std::memory_order_acquire) == DONE;
+		}
+
+		// a suspended state is taken over too, the completer then wakes this thread instead
+		void wait() {
+			auto current = state.load(std::memory_order_acquire);
+			while (current != DONE) {
+				if (current != WAITING && !state.compare_exchange_weak(current, WAITING, std::memory_order_acquire)) {
+					continue;
+				}
+				ns::task_queue::futex_wait(state, WAITING);
+				current = state.load(std::memory_order_acquire);
+			}
+		}
+
+		// true when a coroutine suspended on it and has to be resumed by the caller
+		bool done() {
+			auto old = state.exchange(DONE, std::memory_order_acq_rel);
+			if (old == WAITING) {
+				ns::task_queue::futex_wake(state, true);
+			}
+			return old == SUSPENDED;
+		}
+	};
+}
+
+#endif // __TASK_QUEUE_HPP__
@@ -0,0 +1,129 @@
+#ifndef __TLB_HPP__
+#define __TLB_HPP__
+
+// translation lookaside buffer in front of translator page tables, lookups take no lock
+// set associative array of entries, each guarded by its own sequence counter
+
+#include "type_config.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace db {
+	struct translation_buffer {
+		// even sequence is stable, odd means a writer is in the middle, every write moves it by two
+		// tag is page address with low bit set, 0 for an empty entry
+		struct tlb_entry {
+			std::atomic<std::uint32_t> seq;
+			std::atomic<address> tag;
+			std::atomic<drive_address> value;
+
+			tlb_entry() : seq(0), tag(0), value(0) {
+			}
+		};
+
+		tlb_entry entries[TRANSLATOR_TLB_SETS * TRANSLATOR_TLB_WAYS];
+		std::uint8_t next_way[TRANSLATOR_TLB_SETS] = {}; // round robin replacement, writers only
+
+	public:
+		translation_buffer() {
+		}
+
+		translation_buffer(const translation_buffer &other) = delete;
+		translation_buffer &operator=(const translation_buffer &other) = delete;
+
+		// entry changing during the read counts as a miss, caller falls back to page table walk
+		bool find(address addr, drive_address &value) {
+			auto tag = tag_of(addr);
+			auto set = entries + set_of(addr) * TRANSLATOR_TLB_WAYS;
+			for (std::size_t i = 0; i != TRANSLATOR_TLB_WAYS; ++i) {
+				auto &e = set[i];
+				auto before = e.seq.load(std::memory_order_acquire);
+				if (before & 1) {
+					continue;
+				}
+				auto t = e.tag.load(std::memory_order_relaxed);
+				auto v = e.value.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (t == tag && e.seq.load(std::memory_order_relaxed) == before) {
+					value = v;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// writers are serialized by translator latch
+		void insert(address addr, drive_address value) {
+			auto tag = tag_of(addr);
+			auto index = set_of(addr);
+			auto set = entries + index * TRANSLATOR_TLB_WAYS;
+			tlb_entry *victim = nullptr;
+			for (std::size_t i = 0; i != TRANSLATOR_TLB_WAYS; ++i) {
+				auto t = set[i].tag.load(std::memory_order_relaxed);
+				if (t == tag) {
+					victim = set + i;
+					break;
+				}
+				if (!t && !victim) {
+					victim = set + i;
+				}
+			}
+			if (!victim) {
+				victim = set + next_way[index];
+				next_way[index] = static_cast<std::uint8_t>((next_way[index] + 1) % TRANSLATOR_TLB_WAYS);
+			}
+			write(*victim, tag, value);
+		}
+
+		// reader holding the old sequence sees it move and drops what it read
+		void invalidate(address addr) {
+			auto tag = tag_of(addr);
+			auto set = entries + set_of(addr) * TRANSLATOR_TLB_WAYS;
+			for (std::size_t i = 0; i != TRANSLATOR_TLB_WAYS; ++i) {
+				if (set[i].tag.load(std::memory_order_relaxed) == tag) {
+					write(set[i], 0, 0);
+				}
+			}
+		}
+
+		// pages [first, first + count * PAGE_SIZE), a long range clears everything instead
+		void invalidate(address first, std::size_t count) {
+			if (count >= TRANSLATOR_TLB_SETS * TRANSLATOR_TLB_WAYS) {
+				clear();
+				return;
+			}
+			for (std::size_t i = 0; i != count; ++i) {
+				invalidate(first + i * PAGE_SIZE);
+			}
+		}
+
+		void clear() {
+			for (auto &e : entries) {
+				if (e.tag.load(std::memory_order_relaxed)) {
+					write(e, 0, 0);
+				}
+			}
+		}
+
+	private:
+		inline static address tag_of(address addr) {
+			return (addr & ~(PAGE_SIZE - 1)) | 1;
+		}
+
+		inline static std::size_t set_of(address addr) {
+			return static_cast<std::size_t>((addr >> PAGE_BIT_LENGTH) ^ (addr >> SEGMENT_BIT_LENGTH)) & (TRANSLATOR_TLB_SETS - 1);
+		}
+
+		static void write(tlb_entry &e, address tag, drive_address value) {
+			auto seq = e.seq.load(std::memory_order_relaxed);
+			e.seq.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			e.tag.store(tag, std::memory_order_relaxed);
+			e.value.store(value, std::memory_order_relaxed);
+			e.seq.store(seq + 2, std::memory_order_release);
+		}
+	};
+}
+
+#endif // __TLB_HPP__
@@ -0,0 +1,128 @@
+#ifndef __TRANSACTION_HPP__
+#define __TRANSACTION_HPP__
+
+// multi tuple transaction, changes go to pages in place and abort undoes them tuple by tuple
+// an intent record precedes every change, so after a crash the log tells what an unfinished transaction touched
+
+#include "keeper.hpp"
+#include "pax.hpp"
+#include "tuple.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace db {
+	enum transaction_state_enum {
+		TXN_ACTIVE,
+		TXN_COMMITTED,
+		TXN_ABORTED,
+	};
+
+	struct transaction {
+		keeper *owner;
+		std::uint64_t id;
+		transaction_state_enum state = TXN_ACTIVE;
+		std::vector<address> inserted;
+		std::vector<address> erased;
+		std::vector<address> pages; // pages holding version records of the transaction
+
+	public:
+		explicit transaction(keeper &owner) : owner(&owner), id(owner.begin_txn()) {
+		}
+
+		// unfinished transaction found by recovery, it can only abort
+		transaction(keeper &owner, std::uint64_t id, const std::vector<keeper::txn_intent> &intents) : owner(&owner), id(id) {
+			for (auto &intent : intents) {
+				(intent.type == LOG_TXN_INSERT ? inserted : erased).push_back(intent.addr);
+				touch((intent.addr / PAGE_SIZE) * PAGE_SIZE);
+			}
+		}
+
+		transaction(const transaction &other) = delete;
+		transaction &operator=(const transaction &other) = delete;
+
+		~transaction() {
+			if (state == TXN_ACTIVE) {
+				abort();
+			}
+		}
+
+		// page is latched and loaded by caller, index is allocated but not written yet
+		void will_insert(virtual_page &p, page_address index) {
+			check_active("will_insert");
+			owner->log_txn(LOG_TXN_INSERT, id, p.addr + index);
+			inserted.push_back(p.addr + index);
+			touch(p.addr);
+		}
+
+		// page is latched and loaded by caller, tuple is not freed yet
+		void will_erase(virtual_page &p, page_address index) {
+			check_active("will_erase");
+			owner->log_txn(LOG_TXN_ERASE, id, p.addr + index);
+			erased.push_back(p.addr + index);
+			touch(p.addr);
+		}
+
+		// durable on return, committers arriving together share one log sync
+		void commit() {
+			check_active("commit");
+			owner->end_txn(id, true);
+			owner->versions.commit(id, pages);
+			state = TXN_COMMITTED;
+		}
+
+		// erased tuples come back first, so a tuple inserted and erased by the transaction ends free
+		// undo is idempotent, aborting again after a crash in between is harmless
+		void abort() {
+			check_active("abort");
+			for (auto page : pages) {
+				visit_page(owner->hold(page), [this](auto &p) {
+					this->undo(p);
+				});
+			}
+			owner->versions.abort(id, pages);
+			owner->end_txn(id, false);
+			state = TXN_ABORTED;
+		}
+
+	private:
+		// page is tuple_page or pax_page, both free and restore by index
+		template<typename Page>
+		void undo(Page &p) {
+			p.latch();
+			p.txn = id;
+			try {
+				p.load();
+			} catch (const std::out_of_range &) {
+				return; // header never reached log before crash, nothing to undo
+			}
+			for (auto addr : erased) {
+				if ((addr / PAGE_SIZE) * PAGE_SIZE == p.addr) {
+					p.restore(static_cast<page_address>(addr % PAGE_SIZE));
+				}
+			}
+			for (auto addr : inserted) {
+				if ((addr / PAGE_SIZE) * PAGE_SIZE == p.addr) {
+					p.free(static_cast<page_address>(addr % PAGE_SIZE));
+				}
+			}
+		}
+
+		void touch(address page) {
+			if (pages.empty() || pages.back() != page) {
+				if (std::find(pages.begin(), pages.end(), page) == pages.end()) {
+					pages.push_back(page);
+				}
+			}
+		}
+
+		void check_active(const char *method) {
+			if (state != TXN_ACTIVE) {
+				throw std::runtime_error(std::string("[transaction::") + method + "] transaction is finished");
+			}
+		}
+	};
+}
+
+#endif // __TRANSACTION_HPP__
@@ -1,26 +1,39 @@
 #pragma once
 
-#include "cache.hpp"
 #include "drive.hpp"
 #include "page.hpp"
+#include "tlb.hpp"
 #include "type_config.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace db {
-	// TODO: declare segment usage in entry, only data segment is available for now
+	// segment of one object, a table or an index, level is the keeper cache level its pages go to
 	struct segment_entry {
 		address pos;
 		drive_address mapping_ptr;
 		segment_enum seg;
+		std::size_t level;
 		
-		segment_entry(address pos, drive_address mapping_ptr, segment_enum seg) : pos(pos), mapping_ptr(mapping_ptr), seg(seg) {
+		segment_entry(address pos, drive_address mapping_ptr, segment_enum seg, std::size_t level) : pos(pos), mapping_ptr(mapping_ptr), seg(seg), level(level) {
 		}
 
-		segment_entry(const segment_entry &other) : segment_entry(other.pos, other.mapping_ptr, other.seg) {
+		segment_entry(address pos, drive_address mapping_ptr, segment_enum seg) : segment_entry(pos, mapping_ptr, seg, segment_cache_level(seg)) {
+		}
+
+		segment_entry(const segment_entry &other) : segment_entry(other.pos, other.mapping_ptr, other.seg, other.level) {
 		}
 	};
 
@@ -33,10 +46,15 @@ namespace db {
 		// constexpr static page_address SYSTEM_SEGMENT_TABLE_SIZE_POS = 252;
 		// constexpr static page_address USER_SEGMENT_TABLE_SIZE_POS = 254;
 
+		constexpr static page_address FORMAT_POS = 250;
 		constexpr static page_address SEGMENT_TABLE_SIZE_POS = 254;
 
+		constexpr static page_address CHAIN_FORMAT = 0; // mapping page chain per segment
+		constexpr static page_address RADIX_FORMAT = 1; // radix page table per segment
+
 		constexpr static page_address SEGMENT_ENTRY_POS_POS = 0;
 		constexpr static page_address SEGMENT_ENTRY_SEG_POS = 4;
+		constexpr static page_address SEGMENT_ENTRY_LEVEL_POS = 5; // cache level plus one, 0 takes the default of segment type
 		constexpr static page_address SEGMENT_ENTRY_PTR_POS = 8;
 		constexpr static page_address SEGMENT_ENTRY_SIZE = 16;
 
@@ -45,6 +63,7 @@ namespace db {
 		constexpr static page_address SEGMENT_TABLE_SIZE = (SEGMENT_TABLE_END - SEGMENT_TABLE_BEGIN) / SEGMENT_ENTRY_SIZE;
 
 		std::vector<segment_entry> segment_table;
+		page_address format = RADIX_FORMAT;
 
 	public:
 		translator_page(iterator first, iterator last) : basic_page(first, last) {
@@ -53,29 +72,34 @@ namespace db {
 		}
 
 		virtual void load() {
+			format = read<page_address>(FORMAT_POS);
 			auto segment_table_size = read<page_address>(SEGMENT_TABLE_SIZE_POS);
 			segment_table.clear();
 			for (page_address i = 0; i != segment_table_size; ++i) {
 				auto offset = SEGMENT_ENTRY_SIZE * i + SEGMENT_TABLE_BEGIN;
 				auto shrink_pos = read<shrink_segment_pos_address>(offset + SEGMENT_ENTRY_POS_POS);
 				auto seg = read<segment_enum_type>(offset + SEGMENT_ENTRY_SEG_POS);
+				auto level = read<std::uint8_t>(offset + SEGMENT_ENTRY_LEVEL_POS);
 				auto ptr = read<drive_address>(offset + SEGMENT_ENTRY_PTR_POS);
 				segment_table.emplace_back(
 					static_cast<address>(shrink_pos) << SEGMENT_BIT_LENGTH,
-					ptr, static_cast<segment_enum>(seg)
+					ptr, static_cast<segment_enum>(seg),
+					level ? static_cast<std::size_t>(level - 1) : segment_cache_level(static_cast<segment_enum>(seg))
 				);
 			}
 		}
 
 		virtual void dump() {
-			if (segment_table.size() > SEGMENT_ENTRY_SIZE) {
+			if (segment_table.size() > SEGMENT_TABLE_SIZE) {
 				throw std::out_of_range("[translator_entry_page::dump] segment_table are out of range");
 			}
+			write(format, FORMAT_POS);
 			write(static_cast<page_address>(segment_table.size()), SEGMENT_TABLE_SIZE_POS);
 			page_address i = SEGMENT_TABLE_BEGIN;
 			for (auto &entry : segment_table) {
 				write(static_cast<shrink_segment_pos_address>(entry.pos >> SEGMENT_BIT_LENGTH), i + SEGMENT_ENTRY_POS_POS);
 				write(static_cast<segment_enum_type>(entry.seg), i + SEGMENT_ENTRY_SEG_POS);
+				write(static_cast<std::uint8_t>(entry.level + 1), i + SEGMENT_ENTRY_LEVEL_POS);
 				write(entry.mapping_ptr, i + SEGMENT_ENTRY_PTR_POS);
 				i += SEGMENT_ENTRY_SIZE;
 			}
@@ -102,6 +126,7 @@ namespace db {
 		}
 	};
 
+	// chain page of the old translator format, only read to convert a database to radix table
 	struct mapping_page: page {
 		constexpr static page_address NEXT_PTR_POS = 0;
 
@@ -160,18 +185,93 @@ namespace db {
 		}
 	};
 	
-	// TODO: load all mapping pages without cache in manager, need to improve
-	struct translator: cache_handler<address, drive_address> {
+	// node of a segment page table, entry is the drive address of a child node, or of the page at the last level
+	// page number within the segment is split into LEVELS slots like a hardware page table, 0 is an empty entry
+	struct radix_page : page {
+		constexpr static std::size_t ENTRY_BIT_LENGTH = PAGE_BIT_LENGTH - 3;
+		constexpr static std::size_t ENTRY_COUNT = static_cast<std::size_t>(1) << ENTRY_BIT_LENGTH;
+		constexpr static std::size_t LEVELS = (SEGMENT_BIT_LENGTH - PAGE_BIT_LENGTH + ENTRY_BIT_LENGTH - 1) / ENTRY_BIT_LENGTH;
+		static_assert(ENTRY_COUNT * sizeof(drive_address) == PAGE_SIZE, "radix entries have to fill a page");
+
+		std::vector<drive_address> entries;
+
+		inline radix_page(iterator first, iterator last) : basic_page(first, last), entries(ENTRY_COUNT) {
+		}
+
+		virtual void load() {
+			for (std::size_t i = 0; i != ENTRY_COUNT; ++i) {
+				entries[i] = read<drive_address>(static_cast<page_address>(i * sizeof(drive_address)));
+			}
+		}
+
+		virtual void dump() {
+			for (std::size_t i = 0; i != ENTRY_COUNT; ++i) {
+				write(entries[i], static_cast<page_address>(i * sizeof(drive_address)));
+			}
+		}
+
+		// slot of page number key at level, level 0 is the root
+		inline static std::size_t slot(address key, std::size_t level) {
+			return (key >> (ENTRY_BIT_LENGTH * (LEVELS - 1 - level))) & (ENTRY_COUNT - 1);
+		}
+	};
+
+	struct radix_node {
+		drive_address ptr;
+		std::vector<char> memory;
+		radix_page table;
+		std::vector<std::unique_ptr<radix_node>> children; // resident children, empty at the last level
+		radix_node *parent; // null for a root
+		std::size_t slot; // entry of this node in parent
+		std::size_t resident_children = 0;
+		bool dirty = false; // changed since last save, stays resident until then
+		bool published = false; // ptr is on drive and may belong to a published root, shadow mode moves it before a change
+		std::list<radix_node *>::iterator lru;
+
+		radix_node(drive_address ptr, bool inner, radix_node *parent = nullptr, std::size_t slot = 0) : ptr(ptr), memory(PAGE_SIZE),
+			table(memory.data(), memory.data() + PAGE_SIZE), children(inner ? radix_page::ENTRY_COUNT : 0), parent(parent), slot(slot) {
+		}
+	};
+
+	// segment table of a published root, pages reachable from it stay on drive while it is pinned
+	struct root_snapshot {
+		std::uint64_t epoch;
+		std::vector<segment_entry> segments;
+	};
+
+	// radix nodes are read from drive on first walk and dropped again when clean and least recently used
+	// nodes are addressed by drive address and translation runs under keeper misses, so they keep their own cache
+	// shadow mode never writes a page of the published root in place: changed nodes and pages move to fresh drive pages
+	// and save publishes the new root with a single write of the entry page, replaced pages are freed afterwards
+	struct translator {
 		drive &io;
-		std::vector<std::vector<char>> memories;
+		std::vector<char> memory;
 		translator_page entry;
-		std::vector<std::vector<mapping_page>> mappings;
-		cache<address, drive_address> lookaside;
+		std::vector<std::unique_ptr<radix_node>> roots; // per segment, null until first walk, roots are never dropped
+		std::list<radix_node *> lru; // resident nodes except roots, most recent first
+		std::size_t resident = 0; // nodes in lru
+		std::vector<radix_node *> dirty_nodes; // written by next save, dirty nodes are never dropped
+		bool entry_dirty = false;
+		std::uint64_t node_writes = 0;
+		std::uint64_t node_frees = 0; // nodes dropped once unlinks left them empty
+		translation_buffer tlb; // filled and invalidated under latch, read without it
+		std::atomic<std::uint32_t> segments[TRANSLATOR_SEGMENT_LIMIT]; // by segment number, see segment_value, 0 for none
+		std::recursive_mutex latch; // guards segment table and radix nodes for keeper workers
+
+		bool shadow = false;
+		std::uint64_t epoch = 0; // roots published in shadow mode
+		std::vector<segment_entry> published; // segment table of the last published root
+		std::unordered_set<drive_address> fresh; // data pages allocated since last publish, written in place
+		std::vector<std::pair<drive_address, bool>> retired; // pages replaced since last publish and whether they are system pages
+		std::map<std::uint64_t, std::vector<std::pair<drive_address, bool>>> graveyard; // retired pages by the epoch replacing them
+		std::multiset<std::uint64_t> pinned; // epochs of pinned roots
 
 	public:
-		translator(drive &io) : io(io), lookaside(TRANSLATOR_CACHE_SIZE, *this) {
-			memories.emplace_back(PAGE_SIZE);
-			entry.set_pair_ptr(memories[0].begin(), memories[0].end());
+		translator(drive &io) : io(io), memory(PAGE_SIZE) {
+			for (auto &value : segments) {
+				value.store(0, std::memory_order_relaxed);
+			}
+			entry.set_pair_ptr(memory.data(), memory.data() + PAGE_SIZE);
 			io.get(entry, FIXED_TRANSLATOR_ENTRY_PAGE);
 			if (entry.segment_table.empty()) {
 				init();
@@ -184,155 +284,552 @@ namespace db {
 			save();
 		}
 
-		// TODO: free mapping page and free segment
+		// TODO: free radix node and free segment
 		void init() {
 			const segment_enum default_segment[] = { METADATA_SEG, DATA_SEG, BLOB_SEG, INDEX_SEG,};
+			entry.format = translator_page::RADIX_FORMAT;
+			entry_dirty = true;
 			for (auto i = 0; i != 4; ++i) {
 				add_segment(default_segment[i], default_segment_address(default_segment[i]));
 			}
 			save();
 		}
 
+		// only the entry page is read at open, nodes come with the first translation through them
 		void load() {
-			for (auto iter = entry.segment_table.begin(); iter != entry.segment_table.end(); ++iter) {
-				mappings.emplace_back();
-				auto &seg = mappings.back();
-				auto addr = iter->mapping_ptr;
-				while (addr) {
-					memories.emplace_back(PAGE_SIZE);
-					seg.emplace_back(memories.back().begin(), memories.back().end());
-					io.get(seg.back(), addr);
-					addr = seg.back().next_ptr;
-				}
-				
+			roots.resize(entry.segment_table.size());
+			for (std::size_t i = 0; i != entry.segment_table.size(); ++i) {
+				index_segment(i);
+			}
+			if (entry.format == translator_page::CHAIN_FORMAT) {
+				convert_chains();
 			}
 		}
 
+		// only nodes changed since last save are written, children before parents
+		// so a parent on drive never points at a node that is not there yet
+		// a node left empty by unlinks is cut from its parent instead, its page is freed once the parent is written
+		// in shadow mode the entry page write is the commit point, allocator state goes to drive before it
 		void save() {
-			io.put(entry, FIXED_TRANSLATOR_ENTRY_PAGE);
-			for (std::size_t i = 0; i != entry.segment_table.size(); ++i) {
-				auto addr = entry.segment_table[i].mapping_ptr;
-				auto &seg = mappings[i];
-				for (auto iter = seg.begin(); iter != seg.end(); ++iter) {
-					io.put(*iter, addr);
-					addr = iter->next_ptr;
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto changed = !dirty_nodes.empty() || entry_dirty || !fresh.empty() || !retired.empty();
+			std::sort(dirty_nodes.begin(), dirty_nodes.end(), [](radix_node *a, radix_node *b) {
+				return depth(a) > depth(b);
+			});
+			std::vector<drive_address> emptied;
+			// parents cut from or moved by shadow mode join the list behind their children
+			for (std::size_t i = 0; i != dirty_nodes.size(); ++i) {
+				auto node = dirty_nodes[i];
+				if (node->parent && is_empty(*node)) {
+					drop(*node, emptied);
+					continue;
 				}
+				io.put(node->table, node->ptr);
+				node->dirty = false;
+				node->published = true;
+				++node_writes;
+			}
+			dirty_nodes.clear();
+			if (shadow && changed) {
+				io.sync(); // pages and nodes under the new root are durable before it is published
+				io.put(entry, FIXED_TRANSLATOR_ENTRY_PAGE);
+				entry_dirty = false;
+				published = entry.segment_table;
+				fresh.clear();
+				auto &dead = graveyard[++epoch];
+				dead.insert(dead.end(), retired.begin(), retired.end());
+				retired.clear();
+				release();
+			} else if (entry_dirty) {
+				io.put(entry, FIXED_TRANSLATOR_ENTRY_PAGE);
+				entry_dirty = false;
 			}
+			for (auto ptr : emptied) {
+				io.free(ptr, true);
+			}
+			shrink();
 		}
 
-		void add_segment(segment_enum seg, address addr) {
-			entry.segment_table.emplace_back(addr, 0, seg);
-			mappings.emplace_back();
+		// everything is saved before the switch, roots can not be pinned once shadow mode is off
+		void set_shadow(bool on) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			if (!on && !pinned.empty()) {
+				throw std::runtime_error("[translator::set_shadow] published root is still pinned");
+			}
+			save();
+			shadow = on;
+			published = entry.segment_table;
 		}
 
-		void add_segment(segment_enum seg) {
-			address addr = entry.segment_table.empty() ? 0 : entry.segment_table.back().pos + SEGMENT_SIZE;
-			add_segment(seg, addr);
+		// pages reachable from the returned root are not freed until it is unpinned
+		root_snapshot pin() {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			if (!shadow) {
+				throw std::runtime_error("[translator::pin] roots are published only in shadow mode");
+			}
+			pinned.insert(epoch);
+			return root_snapshot{ epoch, published };
 		}
 
-		inline std::size_t find_segment_index(address addr) {
-			auto iter = std::find_if(entry.segment_table.begin(), entry.segment_table.end(), [addr](const segment_entry &e) {
+		void unpin(const root_snapshot &root) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto iter = pinned.find(root.epoch);
+			if (iter != pinned.end()) {
+				pinned.erase(iter);
+				release();
+			}
+		}
+
+		// translation through a pinned root, nodes are read from drive since resident ones may have moved on
+		drive_address operator()(const root_snapshot &root, address addr) {
+			auto iter = std::find_if(root.segments.begin(), root.segments.end(), [addr](const segment_entry &e) {
 				return addr >= e.pos && addr < e.pos + SEGMENT_SIZE;
 			});
-			if (iter == entry.segment_table.end()) {
+			if (iter == root.segments.end()) {
 				throw std::out_of_range("access address out of any segment");
 			}
-			return static_cast<std::size_t>(iter - entry.segment_table.begin());
+			auto key = (addr - iter->pos) >> PAGE_BIT_LENGTH;
+			std::vector<char> node_memory(PAGE_SIZE);
+			radix_page node(node_memory.data(), node_memory.data() + PAGE_SIZE);
+			auto ptr = iter->mapping_ptr;
+			for (std::size_t level = 0; ptr && level != radix_page::LEVELS; ++level) {
+				io.get(node, ptr);
+				ptr = node.entries[radix_page::slot(key, level)];
+			}
+			if (!ptr) {
+				throw std::runtime_error("[translator] cannot find address mapping value");
+			}
+			return ptr;
+		}
+
+		// drive page to write addr to in shadow mode, a page of the published root moves to a fresh one
+		drive_address place(address addr) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto key = page_number(addr);
+			auto leaf = find_node(find_segment_index(addr), key, false);
+			auto old = leaf ? leaf->table.entries[radix_page::slot(key, radix_page::LEVELS - 1)] : 0;
+			if (old && fresh.find(old) != fresh.end()) {
+				return old;
+			}
+			auto ptr = io.allocate();
+			link(addr, ptr);
+			fresh.insert(ptr);
+			if (old) {
+				retire(old, false);
+			}
+			return ptr;
+		}
+
+		std::string get_database_name() {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			return entry.get_database_name();
+		}
+
+		void set_database_name(const std::string &name) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			entry.set_database_name(name);
+			entry_dirty = true;
+		}
+
+		void add_segment(segment_enum seg, address addr, std::size_t level) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto number = addr >> SEGMENT_BIT_LENGTH;
+			if (addr % SEGMENT_SIZE || number >= TRANSLATOR_SEGMENT_LIMIT || segments[number].load(std::memory_order_relaxed)) {
+				throw std::runtime_error("[translator::add_segment] segment address is unaligned, out of range or taken");
+			}
+			if (entry.segment_table.size() == translator_page::SEGMENT_TABLE_SIZE) {
+				throw std::out_of_range("[translator::add_segment] segment table is full");
+			}
+			entry.segment_table.emplace_back(addr, 0, seg, level);
+			roots.emplace_back();
+			index_segment(entry.segment_table.size() - 1);
+			entry_dirty = true;
+		}
+
+		void add_segment(segment_enum seg, address addr) {
+			add_segment(seg, addr, segment_cache_level(seg));
+		}
+
+		// lowest free segment number, returns the start of the new segment
+		address create_segment(segment_enum seg, std::size_t level) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			std::size_t number = 0;
+			while (number != TRANSLATOR_SEGMENT_LIMIT && segments[number].load(std::memory_order_relaxed)) {
+				++number;
+			}
+			if (number == TRANSLATOR_SEGMENT_LIMIT) {
+				throw std::out_of_range("[translator::add_segment] no free segment number");
+			}
+			auto addr = static_cast<address>(number) << SEGMENT_BIT_LENGTH;
+			add_segment(seg, addr, level);
+			return addr;
+		}
+
+		address create_segment(segment_enum seg) {
+			return create_segment(seg, segment_cache_level(seg));
+		}
+
+		// lookups take no latch, a segment is indexed once it is complete and never removed
+		inline std::size_t find_segment_index(address addr) {
+			return (find_segment_value(addr) & 0xffff) - 1;
 		}
 
 		inline segment_enum find_seg(address addr) {
-			return entry.segment_table[find_segment_index(addr)].seg;
+			return static_cast<segment_enum>((find_segment_value(addr) >> 16) & 0xff);
 		}
 
-		void add_mapping(std::size_t index) {
-			// TODO: new mapping page allocate strategy
-			auto ptr = io.allocate(0, true);
-			auto &mapping = mappings[index];
-			if (!mapping.empty()) {
-				mapping.back().next_ptr = ptr;
-			} else {
-				entry.segment_table[index].mapping_ptr = ptr;
+		inline std::size_t find_cache_level(address addr) {
+			return find_segment_value(addr) >> 24;
+		}
+
+		// one past the last linked page of the segment holding addr, segment start when it links nothing
+		// caller serializes drive io, nodes off the resident path are read from drive
+		address linked_end(address addr) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto index = find_segment_index(addr);
+			auto pos = entry.segment_table[index].pos;
+			find_node(index, 0, false);
+			address key = 0;
+			if (!roots[index] || !last_key(*roots[index], 0, 0, key)) {
+				return pos;
 			}
-			memories.emplace_back(PAGE_SIZE);
-			mapping.emplace_back(memories.back().begin(), memories.back().end());
-			mapping.back().next_ptr = 0;
-			save();
+			return pos + (key + 1) * PAGE_SIZE;
 		}
 
+		// missing nodes on the path are allocated, link and unlink are logged, nodes reach drive at the next checkpoint or close
 		void link(address addr, drive_address ptr) {
-			auto index = find_segment_index(addr);
-			mapping_entry item(addr - entry.segment_table[index].pos, ptr);
-			auto &seg = mappings[index];
-			for (auto iter = seg.begin(); iter != seg.end(); ++iter) {
-				if (iter->mapping_table.size() < mapping_page::MAPPING_TABLE_SIZE) {
-					auto &table = iter->mapping_table;
-					auto pos = std::lower_bound(table.begin(), table.end(), item, [](const mapping_entry &a, const mapping_entry &b) {
-						return a.key < b.key;
-					});
-					table.insert(pos, item);
-					return;
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto key = page_number(addr);
+			auto leaf = find_node(find_segment_index(addr), key, true);
+			leaf->table.entries[radix_page::slot(key, radix_page::LEVELS - 1)] = ptr;
+			mark_dirty(*leaf);
+			tlb.invalidate(addr);
+		}
+
+		// pages from first on get ptrs in order, one walk per last level node instead of one per page
+		void link_range(address first, const std::vector<drive_address> &ptrs) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto index = find_range_index(first, ptrs.size());
+			auto key = page_number(first);
+			for (std::size_t i = 0; i != ptrs.size();) {
+				auto leaf = find_node(index, key + i, true);
+				auto slot = radix_page::slot(key + i, radix_page::LEVELS - 1);
+				auto count = std::min(ptrs.size() - i, radix_page::ENTRY_COUNT - slot);
+				std::copy(ptrs.begin() + i, ptrs.begin() + i + count, leaf->table.entries.begin() + slot);
+				mark_dirty(*leaf);
+				i += count;
+			}
+			tlb.invalidate(first, ptrs.size());
+		}
+
+		// extent, count pages from first on are stored contiguously from ptr on, leaves are filled in place
+		void link_range(address first, drive_address ptr, std::size_t count) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto index = find_range_index(first, count);
+			auto key = page_number(first);
+			for (std::size_t i = 0; i != count;) {
+				auto leaf = find_node(index, key + i, true);
+				auto slot = radix_page::slot(key + i, radix_page::LEVELS - 1);
+				auto n = std::min(count - i, radix_page::ENTRY_COUNT - slot);
+				auto begin = leaf->table.entries.begin() + slot;
+				for (std::size_t j = 0; j != n; ++j) {
+					begin[j] = ptr + (i + j) * PAGE_SIZE;
 				}
+				mark_dirty(*leaf);
+				i += n;
 			}
-			add_mapping(index);
-			seg.back().mapping_table.push_back(item);
-			// TODO: write back strategy
+			tlb.invalidate(first, count);
 		}
 
-		void unlink(address addr) {
-			auto index = find_segment_index(addr);
-			auto &seg = mappings[index];
-			mapping_entry item(addr - entry.segment_table[index].pos, 0);
-			for (auto iter = seg.begin(); iter != seg.end(); ++iter) {
-				auto &table = iter->mapping_table;
-				auto pos = std::lower_bound(table.begin(), table.end(), item, [](const mapping_entry &a, const mapping_entry &b) {
-					return a.key < b.key;
-				});
-				if (pos != table.end() && pos->key == item.key) {
-					table.erase(pos);
-					return;
+		// every page of the range has to be linked, nothing is unlinked otherwise
+		void unlink_range(address first, std::size_t count) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto index = find_range_index(first, count);
+			auto key = page_number(first);
+			for (auto clear : { false, true }) {
+				for (std::size_t i = 0; i != count;) {
+					auto leaf = find_node(index, key + i, false);
+					auto slot = radix_page::slot(key + i, radix_page::LEVELS - 1);
+					auto n = std::min(count - i, radix_page::ENTRY_COUNT - slot);
+					if (!leaf || std::find(leaf->table.entries.begin() + slot, leaf->table.entries.begin() + slot + n, 0) != leaf->table.entries.begin() + slot + n) {
+						throw std::runtime_error("cannot find address");
+					}
+					if (clear) {
+						auto begin = leaf->table.entries.begin() + slot;
+						std::for_each(begin, begin + n, [this](drive_address ptr) {
+							this->retire(ptr, false);
+						});
+						std::fill(begin, begin + n, 0);
+						mark_dirty(*leaf);
+					}
+					i += n;
 				}
 			}
-			throw std::runtime_error("cannot find address");
+			tlb.invalidate(first, count);
+		}
+
+		void unlink(address addr) {
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto key = page_number(addr);
+			auto leaf = find_node(find_segment_index(addr), key, false);
+			auto slot = radix_page::slot(key, radix_page::LEVELS - 1);
+			if (!leaf || !leaf->table.entries[slot]) {
+				throw std::runtime_error("cannot find address");
+			}
+			retire(leaf->table.entries[slot], false);
+			leaf->table.entries[slot] = 0;
+			mark_dirty(*leaf);
+			tlb.invalidate(addr);
 		}
 
+		// tlb hit takes no lock, a miss walks one node per level and may read a node from drive
+		// caller serializes drive io, keeper holds io_mutex
 		drive_address operator()(address addr) {
-			return lookaside.get(addr);
+			drive_address ret;
+			if (tlb.find(addr, ret)) {
+				return ret;
+			}
+			std::unique_lock<std::recursive_mutex> lock(latch);
+			auto key = page_number(addr);
+			auto leaf = find_node(find_segment_index(addr), key, false);
+			ret = leaf ? leaf->table.entries[radix_page::slot(key, radix_page::LEVELS - 1)] : 0;
+			if (!ret) {
+				throw std::runtime_error("[translator] cannot find address mapping value");
+			}
+			tlb.insert(addr, ret);
+			return ret;
 		}
 
-		bool is_pinned(address addr) {
-			lookaside.is_pinned(addr);
+	private:
+		// table index plus one in bits [0, 16), segment type in [16, 24), cache level in [24, 32)
+		void index_segment(std::size_t index) {
+			auto &e = entry.segment_table[index];
+			auto number = e.pos >> SEGMENT_BIT_LENGTH;
+			if (number >= TRANSLATOR_SEGMENT_LIMIT) {
+				throw std::out_of_range("[translator::index_segment] segment number is out of range");
+			}
+			auto value = static_cast<std::uint32_t>(index + 1) | static_cast<std::uint32_t>(e.seg) << 16 | static_cast<std::uint32_t>(e.level) << 24;
+			segments[number].store(value, std::memory_order_release);
 		}
 
-		void pin(address addr) {
-			(*this)(addr);
-			lookaside.pin(addr);
+		inline std::uint32_t find_segment_value(address addr) {
+			auto number = addr >> SEGMENT_BIT_LENGTH;
+			auto value = number < TRANSLATOR_SEGMENT_LIMIT ? segments[number].load(std::memory_order_acquire) : 0;
+			if (!value) {
+				throw std::out_of_range("access address out of any segment");
+			}
+			return value;
 		}
 
-		void unpin(address addr) {
-			if (is_pinned(addr)) {
-				lookaside.unpin(addr);
+		// segment holding the whole range
+		inline std::size_t find_range_index(address first, std::size_t count) {
+			auto index = find_segment_index(first);
+			if (count && find_segment_index(first + (count - 1) * PAGE_SIZE) != index) {
+				throw std::out_of_range("[translator] range crosses segment boundary");
 			}
+			return index;
 		}
 
-		virtual bool cache_insert(address addr, drive_address &value) {
-			auto index = find_segment_index(addr);
-			auto &seg = mappings[index];
-			mapping_entry item(addr - entry.segment_table[index].pos, 0);
-			for (auto iter = seg.begin(); iter != seg.end(); ++iter) {
-				auto &table = iter->mapping_table;
-				auto pos = std::lower_bound(table.begin(), table.end(), item, [](const mapping_entry &a, const mapping_entry &b) {
-					return a.key < b.key;
-				});
-				if (pos != table.end() && pos->key == item.key) {
-					value = pos->value;
+		inline address page_number(address addr) {
+			return (addr - entry.segment_table[find_segment_index(addr)].pos) >> PAGE_BIT_LENGTH;
+		}
+
+		// last level node covering key, null when a node on the path does not exist and create is false
+		radix_node *find_node(std::size_t index, address key, bool create) {
+			auto &root = roots[index];
+			if (!root) {
+				auto ptr = entry.segment_table[index].mapping_ptr;
+				if (ptr) {
+					root = std::make_unique<radix_node>(ptr, radix_page::LEVELS > 1);
+					io.get(root->table, ptr);
+					root->published = true;
+				} else if (create) {
+					root = std::make_unique<radix_node>(io.allocate(0, true), radix_page::LEVELS > 1);
+					mark_dirty(*root);
+					entry.segment_table[index].mapping_ptr = root->ptr;
+					entry_dirty = true;
+				} else {
+					return nullptr;
+				}
+			}
+			auto node = root.get();
+			for (std::size_t level = 0; node && level + 1 != radix_page::LEVELS; ++level) {
+				node = child_of(*node, radix_page::slot(key, level), level + 1, create);
+			}
+			return node;
+		}
+
+		// child at slot on level, read from drive when it is not resident
+		radix_node *child_of(radix_node &node, std::size_t slot, std::size_t level, bool create) {
+			auto &child = node.children[slot];
+			if (child) {
+				lru.splice(lru.begin(), lru, child->lru);
+				return child.get();
+			}
+			auto ptr = node.table.entries[slot];
+			if (!ptr && !create) {
+				return nullptr;
+			}
+			child = std::make_unique<radix_node>(ptr ? ptr : io.allocate(0, true), level + 1 != radix_page::LEVELS, &node, slot);
+			if (ptr) {
+				io.get(child->table, ptr);
+				child->published = true;
+			} else {
+				node.table.entries[slot] = child->ptr;
+				mark_dirty(node);
+				mark_dirty(*child);
+			}
+			child->lru = lru.insert(lru.begin(), child.get());
+			++node.resident_children;
+			++resident;
+			shrink();
+			return child.get();
+		}
+
+		// highest linked page number under node, prefix is the page number bits of the slots above it
+		// an unlinked page can leave an empty node behind until save, so a subtree may link nothing
+		bool last_key(radix_node &node, std::size_t level, address prefix, address &key) {
+			for (auto slot = radix_page::ENTRY_COUNT; slot-- != 0;) {
+				if (!node.table.entries[slot]) {
+					continue;
+				}
+				auto next = (prefix << radix_page::ENTRY_BIT_LENGTH) | slot;
+				if (level + 1 == radix_page::LEVELS) {
+					key = next;
+					return true;
+				}
+				auto child = child_of(node, slot, level + 1, false);
+				if (child && last_key(*child, level + 1, next, key)) {
 					return true;
 				}
 			}
 			return false;
 		}
-		
-		virtual bool cache_erase(address addr, drive_address &value) {
-			return true;
+
+		// drop clean nodes without resident children from the cold end, the most recent node always stays
+		void shrink() {
+			auto iter = lru.end();
+			while (resident > TRANSLATOR_NODE_CACHE_SIZE && iter != lru.begin()) {
+				auto node = *--iter;
+				if (node->dirty || node->resident_children || iter == lru.begin()) {
+					continue;
+				}
+				iter = lru.erase(iter);
+				--resident;
+				--node->parent->resident_children;
+				node->parent->children[node->slot].reset();
+			}
+		}
+
+		inline void mark_dirty(radix_node &node) {
+			if (!node.dirty) {
+				if (shadow && node.published) {
+					relocate(node);
+				}
+				node.dirty = true;
+				dirty_nodes.push_back(&node);
+			}
+		}
+
+		// copy on write of a published node, the new place is linked into its parent and so on up to the root
+		void relocate(radix_node &node) {
+			retire(node.ptr, true);
+			node.ptr = io.allocate(0, true);
+			node.published = false;
+			if (node.parent) {
+				node.parent->table.entries[node.slot] = node.ptr;
+				mark_dirty(*node.parent);
+				return;
+			}
+			for (std::size_t i = 0; i != roots.size(); ++i) {
+				if (roots[i].get() == &node) {
+					entry.segment_table[i].mapping_ptr = node.ptr;
+					entry_dirty = true;
+				}
+			}
+		}
+
+		inline static bool is_empty(radix_node &node) {
+			return std::all_of(node.table.entries.begin(), node.table.entries.end(), [](drive_address ptr) {
+				return !ptr;
+			});
+		}
+
+		// unlink an empty node from its parent and forget it, shadow mode frees the page after publish instead
+		void drop(radix_node &node, std::vector<drive_address> &emptied) {
+			auto parent = node.parent;
+			auto slot = node.slot;
+			if (shadow) {
+				retire(node.ptr, true);
+			} else {
+				emptied.push_back(node.ptr);
+			}
+			parent->table.entries[slot] = 0;
+			mark_dirty(*parent);
+			lru.erase(node.lru);
+			--resident;
+			--parent->resident_children;
+			++node_frees;
+			parent->children[slot].reset();
+		}
+
+		// page dropped from the mapping, a page the published root never saw is free at once
+		void retire(drive_address ptr, bool system) {
+			if (!shadow) {
+				return;
+			}
+			if (!system && fresh.erase(ptr)) {
+				io.free(ptr);
+				return;
+			}
+			retired.emplace_back(ptr, system);
+		}
+
+		// free pages retired by roots newer than every pinned one
+		void release() {
+			auto oldest = pinned.empty() ? std::numeric_limits<std::uint64_t>::max() : *pinned.begin();
+			while (!graveyard.empty() && graveyard.begin()->first <= oldest) {
+				for (auto &pair : graveyard.begin()->second) {
+					io.free(pair.first, pair.second);
+				}
+				graveyard.erase(graveyard.begin());
+			}
+		}
+
+		inline static std::size_t depth(radix_node *node) {
+			std::size_t ret = 0;
+			for (; node->parent; node = node->parent) {
+				++ret;
+			}
+			return ret;
+		}
+
+		// database written with mapping page chains, entries are linked again into radix tables
+		// chain pages are freed once the tables are on drive
+		void convert_chains() {
+			std::vector<char> chain_memory(PAGE_SIZE);
+			mapping_page chain(chain_memory.data(), chain_memory.data() + PAGE_SIZE);
+			std::vector<std::pair<address, drive_address>> links;
+			std::vector<drive_address> chains;
+			for (auto &seg : entry.segment_table) {
+				for (auto ptr = seg.mapping_ptr; ptr; ptr = chain.next_ptr) {
+					chains.push_back(ptr);
+					io.get(chain, ptr);
+					for (auto &item : chain.mapping_table) {
+						links.emplace_back(seg.pos + item.key, item.value);
+					}
+				}
+				seg.mapping_ptr = 0;
+			}
+			entry.format = translator_page::RADIX_FORMAT;
+			entry_dirty = true;
+			for (auto &pair : links) {
+				link(pair.first, pair.second);
+			}
+			save();
+			for (auto ptr : chains) {
+				io.free(ptr, true);
+			}
 		}
 	};
-}
\ No newline at end of file
+}
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <iterator>
+#include <map>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -56,13 +57,20 @@ namespace db {
 		page_address back_ptr;
 
 		std::vector<piece_entry> piece_table;
+		bool modified = false; // dump of an unmodified page writes nothing
+		bool latched = false; // writer keeps the page pinned from load to dump
+		std::uint64_t txn = 0; // transaction changing the page, 0 commits with dump
 	public:
 		virtual void load() {
 			reactivate();
-			while (!pin()) {
-			}
+			pin_wait();
+			modified = false;
 			flags = read<page_address>(FLAGS_POS);
 			piece_table.clear();
+			if (flags && flags != ROW_PAGE) {
+				unpin();
+				throw std::runtime_error("[tuple_page::load] page is not in row format");
+			}
 			if (flags) {
 				used_size = read<page_address>(USED_SIZE_POS);
 				front_ptr = read<page_address>(FRONT_PTR_POS);
@@ -88,10 +96,12 @@ namespace db {
 		}
 
 		virtual void dump() {
+			if (!modified) {
+				return;
+			}
 			order_by_position();
 			reactivate();
-			while (!pin()) {
-			}
+			pin_wait();
 			if (flags) {
 				write(flags, FLAGS_POS);
 				write(used_size, USED_SIZE_POS);
@@ -108,7 +118,12 @@ namespace db {
 					write(ptr, i + PIECE_ENTRY_PTR_POS);
 					i += PIECE_ENTRY_SIZE;
 				}
+				log_range(FLAGS_POS, i);
+			}
+			if (owner) {
+				owner->versions.commit(addr); // header is written, new versions become visible together
 			}
+			modified = false;
 			unpin();
 			order_by_index();
 		}
@@ -117,7 +132,8 @@ namespace db {
 		}
 
 		void init() {
-			flags = 1;
+			modified = true;
+			flags = ROW_PAGE;
 			front_ptr = HEADER_SIZE;
 			used_size = HEADER_SIZE;
 			back_ptr = PAGE_SIZE;
@@ -127,6 +143,49 @@ namespace db {
 			dump();
 		}
 
+		// pin across load, changes and dump, so a reader copying the page never sees a half written header
+		void latch() {
+			reactivate();
+			pin_wait();
+			latched = true;
+		}
+
+		void unlatch() {
+			if (latched) {
+				latched = false;
+				unpin();
+			}
+		}
+
+		void unpin() {
+			if (!latched) {
+				virtual_page::unpin();
+			}
+		}
+
+		// rows visible at snapshot, page is pinned only while its image is copied
+		std::map<page_address, std::vector<char>> read_snapshot(std::uint64_t snapshot) {
+			std::vector<char> image(PAGE_SIZE);
+			reactivate();
+			pin_wait();
+			std::copy(begin(), end(), image.begin());
+			unpin();
+			tuple_page copy(virtual_page(page(image.data(), image.data() + PAGE_SIZE), nullptr, nullptr, addr, mode));
+			copy.load();
+			std::map<page_address, std::vector<char>> rows;
+			for (auto &entry : copy.piece_table) {
+				if (!entry.is_free) {
+					auto &row = rows[entry.index];
+					row.resize(entry.size());
+					copy.copy_to(row.begin(), entry.begin, entry.end);
+				}
+			}
+			if (owner) {
+				owner->versions.rollback(addr, snapshot, rows);
+			}
+			return rows;
+		}
+
 		void order_by_index() {
 			std::sort(piece_table.begin(), piece_table.end(), [](const piece_entry &a, const piece_entry &b) {
 				return a.index < b.index;
@@ -164,13 +223,16 @@ namespace db {
 			}
 		}
 
+		inline bool is_live(page_address index) {
+			return get(index).second != 0;
+		}
+
 		// copy without checking outer layer should check
 		template<typename Iter,
 			ns::tuple::enable_if_char_iterator_t<Iter> * = nullptr
 		> void copy_to(Iter out, page_address begin, page_address end) {
 			reactivate();
-			while (!pin()) {
-			}
+			pin_wait();
 			for (auto i = begin; i != end; ++i) {
 				*out++ = read<char>(i);
 			}
@@ -180,11 +242,11 @@ namespace db {
 			ns::tuple::enable_if_char_iterator_t<Iter> * = nullptr
 		> void copy_from(Iter in, page_address begin, page_address end) {
 			reactivate();
-			while (!pin()) {
-			}
+			pin_wait();
 			for (auto i = begin; i != end; ++i) {
 				write(*in++, i);
 			}
+			log_range(begin, end);
 			unpin();
 		}
 
@@ -193,6 +255,10 @@ namespace db {
 			page_address tmp = 0;
 			for (; iter != piece_table.end() && iter->index == tmp; ++iter, ++tmp) {
 			}
+			if (owner) {
+				owner->versions.record(addr, tmp, false, nullptr, nullptr, txn);
+			}
+			modified = true;
 			back_ptr -= size;
 			front_ptr += PIECE_ENTRY_SIZE;
 			used_size += size + PIECE_ENTRY_SIZE;
@@ -215,16 +281,32 @@ namespace db {
 		void free(page_address index) {
 			auto pos = get_pos(index);
 			if (pos != piece_table.size() && !piece_table[pos].is_free) {
+				if (owner) {
+					std::vector<char> before(piece_table[pos].size());
+					copy_to(before.begin(), piece_table[pos].begin, piece_table[pos].end);
+					owner->versions.record(addr, index, true, before.data(), before.data() + before.size(), txn);
+				}
+				modified = true;
 				piece_table[pos].is_free = true;
 				used_size -= static_cast<page_address>(piece_table[pos].size());
 			}
 		}
 
+		// undo free of an aborted transaction, bytes of a free piece stay until sweep
+		void restore(page_address index) {
+			auto pos = get_pos(index);
+			if (pos != piece_table.size() && piece_table[pos].is_free) {
+				modified = true;
+				piece_table[pos].is_free = false;
+				used_size += static_cast<page_address>(piece_table[pos].size());
+			}
+		}
+
 		void sweep() {
+			modified = true;
 			order_by_position();
 			reactivate();
-			while (!pin()) {
-			}
+			pin_wait();
 			front_ptr = HEADER_SIZE;
 			back_ptr = PAGE_SIZE;
 			for (auto &entry : piece_table) {
@@ -238,6 +320,7 @@ namespace db {
 					entry.begin = back_ptr;
 				}
 			}
+			log_range(back_ptr, static_cast<page_address>(PAGE_SIZE));
 			unpin();
 			used_size = PAGE_SIZE - back_ptr + front_ptr;
 			piece_table.erase(std::remove_if(piece_table.begin(), piece_table.end(), [](const piece_entry &e) {
@@ -248,6 +331,7 @@ namespace db {
 
 		~tuple_page() {
 			close();
+			unlatch();
 		}
 	};
 
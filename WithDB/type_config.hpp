@@ -4,6 +4,7 @@
 #include <chrono>
 #include <cstdint>
 #include <random>
+#include <stdexcept>
 #include <string>
 
 namespace db {
@@ -28,6 +29,19 @@ namespace db {
 	};
 	using segment_enum_type = std::uint8_t;
 
+	// access pattern hint for keeper, scan pages pass through a private ring and never pollute the main cache
+	enum access_enum {
+		DEFAULT_ACCESS,
+		SCAN_ACCESS,
+	};
+
+	// layout of a data page, kept as flags of the page header, clean page has none
+	enum page_format_enum {
+		CLEAN_PAGE,
+		ROW_PAGE, // slotted whole tuples
+		PAX_PAGE, // one minipage per attribute
+	};
+
 	using element_type = char;
 	using char_type = std::string;
 	using varchar_type = std::string;
@@ -64,10 +78,36 @@ namespace db {
 	constexpr drive_address EXPAND_SIZE = PAGE_SIZE * 0x20;
 	constexpr drive_address SHRINK_SIZE = PAGE_SIZE * 0x10;
 
-	constexpr std::size_t TRANSLATOR_CACHE_SIZE = 0x800;
+	constexpr std::size_t TRANSLATOR_NODE_CACHE_SIZE = 0x400; // resident radix nodes of translator beyond roots, dirty nodes stay until save
+	constexpr std::size_t TRANSLATOR_TLB_SETS = 0x100; // power of two
+	constexpr std::size_t TRANSLATOR_TLB_WAYS = 4;
+	constexpr std::size_t TRANSLATOR_SEGMENT_LIMIT = 0x100; // segment numbers, addresses stay below this many segments
 	constexpr std::size_t KEEPER_CACHE_TOTAL_SIZE = 0x400;
 	constexpr std::size_t KEEPER_CACHE_LEVEL = 3;
 	constexpr std::size_t KEEPER_CACHE_LEVEL_SIZES[KEEPER_CACHE_LEVEL] = { 0x20, 0x80, 0x300 };
+	constexpr std::size_t KEEPER_SCAN_RING = KEEPER_CACHE_LEVEL; // index of scan ring in keeper caches
+	constexpr std::size_t KEEPER_SCAN_RING_SIZE = 0x10;
+	constexpr std::size_t KEEPER_SCAN_BATCH = KEEPER_SCAN_RING_SIZE / 2; // pages held together by a scan, fits the ring when the scan runs alone
+	constexpr std::size_t KEEPER_SCAN_RING_WAIT = 1000; // milliseconds a scan hold backs off on a ring pinned full by other scans before it fails
+	constexpr std::size_t KEEPER_WORKER_COUNT = 4;
+	constexpr std::size_t KEEPER_REQUEST_SLOTS = 0x100; // in-flight keeper requests, power of two
+	constexpr std::size_t EXECUTOR_THREAD_COUNT = 2;
+	constexpr std::size_t EXECUTOR_QUEUE_SIZE = KEEPER_REQUEST_SLOTS * 4; // power of two
+	constexpr std::size_t KEEPER_STATS_LOG_INTERVAL = 0; // milliseconds between keeper stats log lines, 0 to disable
+	constexpr std::uint64_t KEEPER_CHECKPOINT_LOG_SIZE = 0x1000000; // log bytes between two fuzzy checkpoints, bounds redo at restart
+	constexpr std::size_t KEEPER_CHECKPOINT_BATCH = 0x20; // frames written back by one background step of a checkpoint
+	constexpr std::size_t KEEPER_WRITE_BACK_WAIT = 1000; // milliseconds a shadow commit or switch waits for a pinned dirty frame before it fails
+	constexpr std::size_t KEEPER_PLACEMENT_STRIPES = 0x40; // address stripes serializing the choice between a cache level and scan ring
+	constexpr std::size_t VERSION_STORE_SHARDS = 0x40; // latches of tuple version chains, pages are spread by address
+	constexpr std::size_t SCAN_BATCH_ROWS = 0x400; // rows of one batch of a vectorized scan
+	constexpr std::size_t PAX_VARCHAR_RESERVE = 0x20; // heap bytes a pax page expects per varchar value when sizing its minipages
+
+	// cache level arena placement, a level is one shard bound to the node given here or interleaved over all nodes
+	// every level interleaves by default, the node count is not detected, bind a level by its node number on a known box
+	constexpr int ARENA_INTERLEAVE_NODE = -1;
+	constexpr std::size_t ARENA_HUGE_PAGE_SIZE = static_cast<std::size_t>(1) << 21;
+	constexpr bool KEEPER_ARENA_HUGE_PAGE = true;
+	constexpr int KEEPER_CACHE_LEVEL_NODES[KEEPER_CACHE_LEVEL] = { ARENA_INTERLEAVE_NODE, ARENA_INTERLEAVE_NODE, ARENA_INTERLEAVE_NODE };
 
 	inline timestamp current_timestamp() {
 		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
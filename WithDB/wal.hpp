@@ -0,0 +1,540 @@
+#ifndef __WAL_HPP__
+#define __WAL_HPP__
+
+// write-ahead log, records are appended to memory and forced to disk by groups
+
+#include "type_config.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace db {
+	enum log_record_enum : std::uint16_t {
+		LOG_PAGE_WRITE = 1, // address, page offset and bytes written at the offset
+		LOG_LINK = 2, // address and drive address
+		LOG_UNLINK = 3, // address
+		LOG_CHECKPOINT = 4, // lsn redo starts from
+		LOG_TXN_INSERT = 5, // transaction and address of the tuple it inserted
+		LOG_TXN_ERASE = 6, // transaction and address of the tuple it erased
+		LOG_TXN_COMMIT = 7, // transaction
+		LOG_TXN_ABORT = 8, // transaction, its changes are undone
+		LOG_SEGMENT = 9, // start address, segment type and cache level of a new segment
+	};
+
+	namespace ns::wal {
+		// lsn [0, 8), type [8, 10), payload size [10, 12), checksum [12, 16), payload
+		constexpr std::size_t HEADER_SIZE = 16;
+
+		inline std::uint32_t checksum(const char *first, const char *last, std::uint32_t seed = 2166136261u) {
+			for (; first != last; ++first) {
+				seed = (seed ^ static_cast<unsigned char>(*first)) * 16777619u;
+			}
+			return seed;
+		}
+
+		template<typename Type>
+		inline void put(std::vector<char> &out, Type value) {
+			for (std::size_t i = 0; i != sizeof(Type); ++i) {
+				out.push_back(static_cast<char>((static_cast<std::uint64_t>(value) >> (i * 8)) & 0xff));
+			}
+		}
+
+		template<typename Type>
+		inline Type get(const char *in) {
+			std::uint64_t value = 0;
+			for (std::size_t i = 0; i != sizeof(Type); ++i) {
+				value |= static_cast<std::uint64_t>(static_cast<unsigned char>(in[i])) << (i * 8);
+			}
+			return static_cast<Type>(value);
+		}
+	}
+
+	struct log_record {
+		std::uint64_t lsn;
+		log_record_enum type;
+		std::vector<char> payload;
+
+	public:
+		inline address get_address() const {
+			return ns::wal::get<address>(payload.data());
+		}
+
+		// LOG_PAGE_WRITE
+		inline page_address get_offset() const {
+			return ns::wal::get<page_address>(payload.data() + sizeof(address));
+		}
+
+		inline const char *bytes_begin() const {
+			return payload.data() + sizeof(address) + sizeof(page_address);
+		}
+
+		inline const char *bytes_end() const {
+			return payload.data() + payload.size();
+		}
+
+		// LOG_LINK
+		inline drive_address get_drive_address() const {
+			return ns::wal::get<drive_address>(payload.data() + sizeof(address));
+		}
+
+		// LOG_CHECKPOINT
+		inline std::uint64_t get_redo_lsn() const {
+			return ns::wal::get<std::uint64_t>(payload.data());
+		}
+
+		// LOG_TXN_*
+		inline std::uint64_t get_txn() const {
+			return ns::wal::get<std::uint64_t>(payload.data());
+		}
+
+		// LOG_TXN_INSERT, LOG_TXN_ERASE
+		inline address get_txn_address() const {
+			return ns::wal::get<address>(payload.data() + sizeof(std::uint64_t));
+		}
+
+		// LOG_SEGMENT
+		inline segment_enum get_segment() const {
+			return static_cast<segment_enum>(ns::wal::get<segment_enum_type>(payload.data() + sizeof(address)));
+		}
+
+		inline std::size_t get_cache_level() const {
+			return ns::wal::get<std::uint8_t>(payload.data() + sizeof(address) + sizeof(segment_enum_type));
+		}
+	};
+
+	// lsn is the end offset of a record plus the length of logs truncated before, so it never goes back
+	// append only copies to memory, flush(lsn) makes one thread write and sync for every waiting committer
+	struct wal {
+		std::string path;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+#else
+		int file = -1;
+#endif
+		std::mutex latch;
+		std::condition_variable flushed;
+		std::vector<char> buffer; // appended records not written yet
+		std::vector<char> writing; // swapped with buffer by the flushing thread
+		std::uint64_t base = 0; // lsn of file offset 0
+		std::uint64_t next_lsn = 0;
+		std::uint64_t durable_lsn = 0;
+		bool flushing = false;
+		bool failed = false; // a failed write could not be cut back, later records would not line up with their lsn
+		std::uint64_t flush_cnt = 0; // number of syncs, group commit shares one sync among many records
+
+	public:
+		wal() {
+		}
+
+		explicit wal(const std::string &path, bool trunc = false) {
+			open(path, trunc);
+		}
+
+		wal(const wal &other) = delete;
+		wal &operator=(const wal &other) = delete;
+
+		~wal() {
+			close();
+		}
+
+		void open(const std::string &path, bool trunc = false) {
+			close();
+			this->path = path;
+			if (trunc) {
+				std::filesystem::remove(path);
+			}
+			open_file();
+			failed = false;
+			base = 0;
+			// torn tail is cut before anything is appended, records behind it would never be read again
+			auto records = read_valid();
+			if (!records.empty()) {
+				// log cut by discard or truncate starts in the middle of the lsn space
+				auto &first = records.front();
+				base = first.lsn - ns::wal::HEADER_SIZE - first.payload.size();
+			}
+			next_lsn = durable_lsn = base + file_size();
+		}
+
+		void close() {
+			if (is_open()) {
+				flush();
+				close_file();
+			}
+		}
+
+		std::uint64_t append(log_record_enum type, const std::vector<char> &payload) {
+			if (payload.size() > 0xffff) {
+				throw std::out_of_range("[wal::append] payload is too large");
+			}
+			std::unique_lock<std::mutex> lock(latch);
+			return append_locked(type, payload);
+		}
+
+		// latch must be held
+		std::uint64_t append_locked(log_record_enum type, const std::vector<char> &payload) {
+			auto begin = buffer.size();
+			auto lsn = next_lsn + ns::wal::HEADER_SIZE + payload.size();
+			ns::wal::put(buffer, lsn);
+			ns::wal::put(buffer, static_cast<std::uint16_t>(type));
+			ns::wal::put(buffer, static_cast<std::uint16_t>(payload.size()));
+			auto sum = ns::wal::checksum(buffer.data() + begin, buffer.data() + buffer.size());
+			sum = ns::wal::checksum(payload.data(), payload.data() + payload.size(), sum);
+			ns::wal::put(buffer, sum);
+			buffer.insert(buffer.end(), payload.begin(), payload.end());
+			next_lsn = lsn;
+			return lsn;
+		}
+
+		inline std::uint64_t last_lsn() {
+			std::unique_lock<std::mutex> lock(latch);
+			return next_lsn;
+		}
+
+		inline std::uint64_t flushed_lsn() {
+			std::unique_lock<std::mutex> lock(latch);
+			return durable_lsn;
+		}
+
+		// group commit: the first waiter writes everything appended so far, later waiters ride along
+		void flush(std::uint64_t lsn) {
+			std::unique_lock<std::mutex> lock(latch);
+			while (durable_lsn < lsn) {
+				if (flushing) {
+					flushed.wait(lock);
+					continue;
+				}
+				if (failed) {
+					throw std::runtime_error("[wal::flush] log failed before");
+				}
+				flushing = true;
+				writing.swap(buffer);
+				auto target = next_lsn;
+				lock.unlock();
+				std::exception_ptr error;
+				try {
+					write_file(writing.data(), writing.size());
+					sync_file();
+				} catch (...) {
+					error = std::current_exception();
+				}
+				lock.lock();
+				flushing = false;
+				if (!error) {
+					durable_lsn = target;
+					++flush_cnt;
+				} else {
+					// records go back in front of those appended meanwhile, a partial write is cut so a retry lines up
+					writing.insert(writing.end(), buffer.begin(), buffer.end());
+					buffer.swap(writing);
+					try {
+						resize_file(durable_lsn - base);
+					} catch (...) {
+						failed = true;
+					}
+				}
+				writing.clear();
+				flushed.notify_all();
+				if (error) {
+					std::rethrow_exception(error);
+				}
+			}
+		}
+
+		void flush() {
+			flush(last_lsn());
+		}
+
+		// records from the beginning, a torn or corrupted tail ends the log and is cut from the file
+		std::vector<log_record> read_all() {
+			flush();
+			std::unique_lock<std::mutex> lock(latch);
+			while (flushing) {
+				flushed.wait(lock);
+			}
+			return read_valid();
+		}
+
+		// drop records before lsn, lsn has to be a record boundary
+		// the rest is copied to a new file renamed over the log, a crash leaves either the old or the new log
+		void discard(std::uint64_t lsn) {
+			flush();
+			std::unique_lock<std::mutex> lock(latch);
+			while (flushing) {
+				flushed.wait(lock);
+			}
+			if (lsn <= base) {
+				return;
+			}
+			auto size = file_size();
+			auto offset = std::min<std::uint64_t>(lsn - base, size);
+			std::vector<char> tail(static_cast<std::size_t>(size - offset));
+			read_file(tail.data(), tail.size(), offset);
+			close_file();
+			auto origin = path;
+			path = origin + ".tmp";
+			std::filesystem::remove(path);
+			open_file();
+			write_file(tail.data(), tail.size());
+			sync_file();
+			close_file();
+			std::filesystem::rename(path, origin);
+			path = origin;
+			open_file();
+			base += offset;
+		}
+
+		// drop every record appended before, caller has made their changes durable in the database file
+		// latch is held from the last write to the cut, so no record slips in between
+		// new file starts with a checkpoint record, lsn goes on from it after reopen and stamps of resident frames stay valid
+		void truncate() {
+			std::unique_lock<std::mutex> lock(latch);
+			while (flushing) {
+				flushed.wait(lock);
+			}
+			if (failed) {
+				throw std::runtime_error("[wal::truncate] log failed before");
+			}
+			resize_file(0);
+			base = next_lsn;
+			buffer.clear();
+			std::vector<char> payload;
+			ns::wal::put(payload, base);
+			append_locked(LOG_CHECKPOINT, payload);
+			try {
+				write_file(buffer.data(), buffer.size());
+				sync_file();
+			} catch (...) {
+				failed = true;
+				throw;
+			}
+			buffer.clear();
+			durable_lsn = next_lsn;
+			++flush_cnt;
+		}
+
+		// helpers building payloads of each record type
+		std::uint64_t append_write(address addr, page_address offset, const char *first, const char *last) {
+			std::vector<char> payload;
+			payload.reserve(sizeof(address) + sizeof(page_address) + (last - first));
+			ns::wal::put(payload, addr);
+			ns::wal::put(payload, offset);
+			payload.insert(payload.end(), first, last);
+			return append(LOG_PAGE_WRITE, payload);
+		}
+
+		std::uint64_t append_link(address addr, drive_address ptr) {
+			std::vector<char> payload;
+			ns::wal::put(payload, addr);
+			ns::wal::put(payload, ptr);
+			return append(LOG_LINK, payload);
+		}
+
+		std::uint64_t append_unlink(address addr) {
+			std::vector<char> payload;
+			ns::wal::put(payload, addr);
+			return append(LOG_UNLINK, payload);
+		}
+
+		std::uint64_t append_txn(log_record_enum type, std::uint64_t txn, address addr = 0) {
+			std::vector<char> payload;
+			ns::wal::put(payload, txn);
+			if (type == LOG_TXN_INSERT || type == LOG_TXN_ERASE) {
+				ns::wal::put(payload, addr);
+			}
+			return append(type, payload);
+		}
+
+		std::uint64_t append_segment(address addr, segment_enum seg, std::size_t level) {
+			std::vector<char> payload;
+			ns::wal::put(payload, addr);
+			ns::wal::put(payload, static_cast<segment_enum_type>(seg));
+			ns::wal::put(payload, static_cast<std::uint8_t>(level));
+			return append(LOG_SEGMENT, payload);
+		}
+
+		std::uint64_t append_checkpoint(std::uint64_t redo_lsn) {
+			std::vector<char> payload;
+			ns::wal::put(payload, redo_lsn);
+			return append(LOG_CHECKPOINT, payload);
+		}
+
+	private:
+		// records of the valid prefix of the file, the rest is cut, latch is held or the log is not shared yet
+		std::vector<log_record> read_valid() {
+			std::vector<char> content(static_cast<std::size_t>(file_size()));
+			read_file(content.data(), content.size());
+			std::vector<log_record> ret;
+			std::size_t pos = 0;
+			while (pos + ns::wal::HEADER_SIZE <= content.size()) {
+				auto head = content.data() + pos;
+				auto size = ns::wal::get<std::uint16_t>(head + 10);
+				if (pos + ns::wal::HEADER_SIZE + size > content.size()) {
+					break;
+				}
+				auto sum = ns::wal::checksum(head, head + 12);
+				sum = ns::wal::checksum(head + ns::wal::HEADER_SIZE, head + ns::wal::HEADER_SIZE + size, sum);
+				if (sum != ns::wal::get<std::uint32_t>(head + 12)) {
+					break;
+				}
+				log_record record;
+				record.lsn = ns::wal::get<std::uint64_t>(head);
+				record.type = static_cast<log_record_enum>(ns::wal::get<std::uint16_t>(head + 8));
+				record.payload.assign(head + ns::wal::HEADER_SIZE, head + ns::wal::HEADER_SIZE + size);
+				ret.push_back(std::move(record));
+				pos += ns::wal::HEADER_SIZE + size;
+			}
+			if (pos != content.size()) {
+				resize_file(pos);
+				sync_file();
+			}
+			return ret;
+		}
+
+	public:
+#ifdef _WIN32
+		inline bool is_open() const {
+			return file != INVALID_HANDLE_VALUE;
+		}
+
+	private:
+		void open_file() {
+			file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE) {
+				throw std::runtime_error("[wal::open] cannot open log file");
+			}
+		}
+
+		void close_file() {
+			CloseHandle(file);
+			file = INVALID_HANDLE_VALUE;
+		}
+
+		std::uint64_t file_size() {
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file, &size)) {
+				throw std::runtime_error("[wal::file_size] cannot get log size");
+			}
+			return static_cast<std::uint64_t>(size.QuadPart);
+		}
+
+		void write_file(const char *data, std::size_t size) {
+			LARGE_INTEGER zero = {};
+			SetFilePointerEx(file, zero, nullptr, FILE_END);
+			while (size) {
+				DWORD done = 0;
+				if (!WriteFile(file, data, static_cast<DWORD>(size), &done, nullptr)) {
+					throw std::runtime_error("[wal::write] cannot write log");
+				}
+				data += done;
+				size -= done;
+			}
+		}
+
+		void read_file(char *data, std::size_t size, std::uint64_t offset = 0) {
+			LARGE_INTEGER pos;
+			pos.QuadPart = static_cast<LONGLONG>(offset);
+			SetFilePointerEx(file, pos, nullptr, FILE_BEGIN);
+			while (size) {
+				DWORD done = 0;
+				if (!ReadFile(file, data, static_cast<DWORD>(size), &done, nullptr) || !done) {
+					throw std::runtime_error("[wal::read] cannot read log");
+				}
+				data += done;
+				size -= done;
+			}
+		}
+
+		void sync_file() {
+			if (!FlushFileBuffers(file)) {
+				throw std::runtime_error("[wal::sync] cannot sync log");
+			}
+		}
+
+		void resize_file(std::uint64_t size) {
+			LARGE_INTEGER pos;
+			pos.QuadPart = static_cast<LONGLONG>(size);
+			if (!SetFilePointerEx(file, pos, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+				throw std::runtime_error("[wal::truncate] cannot truncate log");
+			}
+		}
+#else
+		inline bool is_open() const {
+			return file >= 0;
+		}
+
+	private:
+		void open_file() {
+			file = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+			if (file < 0) {
+				throw std::runtime_error("[wal::open] cannot open log file");
+			}
+		}
+
+		void close_file() {
+			::close(file);
+			file = -1;
+		}
+
+		std::uint64_t file_size() {
+			struct stat st;
+			if (fstat(file, &st)) {
+				throw std::runtime_error("[wal::file_size] cannot get log size");
+			}
+			return static_cast<std::uint64_t>(st.st_size);
+		}
+
+		void write_file(const char *data, std::size_t size) {
+			while (size) {
+				auto done = ::write(file, data, size);
+				if (done < 0) {
+					throw std::runtime_error("[wal::write] cannot write log");
+				}
+				data += done;
+				size -= static_cast<std::size_t>(done);
+			}
+		}
+
+		void read_file(char *data, std::size_t size, std::uint64_t offset = 0) {
+			while (size) {
+				auto done = ::pread(file, data, size, static_cast<off_t>(offset));
+				if (done <= 0) {
+					throw std::runtime_error("[wal::read] cannot read log");
+				}
+				data += done;
+				offset += done;
+				size -= static_cast<std::size_t>(done);
+			}
+		}
+
+		void sync_file() {
+			if (fdatasync(file)) {
+				throw std::runtime_error("[wal::sync] cannot sync log");
+			}
+		}
+
+		void resize_file(std::uint64_t size) {
+			if (ftruncate(file, static_cast<off_t>(size))) {
+				throw std::runtime_error("[wal::truncate] cannot truncate log");
+			}
+		}
+#endif
+	};
+}
+
+#endif // __WAL_HPP__